@@ -0,0 +1,111 @@
+#include "memory.h"
+#include "workbook.h"
+#include <cstdio>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+static const char* BENCH_FILE = "retrocalc_footprint.tmp";
+
+static std::string columnName(int col) {
+    std::string name;
+    for (col++; col > 0; col = (col - 1) / 26) {
+        name.insert(name.begin(), static_cast<char>('A' + (col - 1) % 26));
+    }
+    return name;
+}
+
+static void fillSheet(Matrix& matrix, size_t cells) {
+    size_t placed = 0;
+    for (int row = 0; row < MAX_ROWS && placed < cells; row++) {
+        for (int col = 0; col < MAX_COLS && placed < cells; col++, placed++) {
+            Cell cell;
+            if (col % 4 == 0) {
+                cell.setLabel("Item " + std::to_string(row * MAX_COLS + col));
+            } else if (col % 4 == 3) {
+                std::string rowLabel = std::to_string(row + 1);
+                cell.setValue("+" + columnName(col - 2) + rowLabel + "*2+" + columnName(col - 1) + rowLabel, 0.0);
+            } else {
+                cell.setValue(std::to_string(row * 0.5 + col), 0.0);
+            }
+            matrix.setCell(row, col, cell);
+        }
+    }
+}
+
+static bool writeWorkbook(size_t sheets, size_t cellsPerSheet) {
+    Workbook workbook;
+    for (size_t i = 0; i < sheets; i++) {
+        if (i > 0) workbook.addSheet("SHEET" + std::to_string(i + 1));
+        fillSheet(workbook.sheetAt(i), cellsPerSheet);
+    }
+    return workbook.saveToFile(BENCH_FILE);
+}
+
+static bool measure(size_t sheets, size_t cacheLimit) {
+    size_t before = heapAllocatedBytes();
+    Workbook workbook;
+    workbook.sheetCacheLimit = cacheLimit;
+    workbook.loadFromFile(BENCH_FILE);
+    for (size_t i = 0; i < workbook.sheetCount(); i++) {
+        workbook.sheetAt(i).recalculate();
+        workbook.trimCache();
+    }
+    size_t heap = heapAllocatedBytes() - before;
+    MemoryUsage usage = workbook.memoryUsage();
+
+    std::printf("%9zu %6zu %6zu %9s %6zu %9s %6zu %9s | %8s %8s %8s %8s %8s\n",
+        usage.cellCount, sheets, workbook.loadedSheetCount(),
+        formatBytes(usage.total()).c_str(), usage.bytesPerCell(),
+        formatBytes(heap).c_str(), usage.cellCount > 0 ? heap / usage.cellCount : 0,
+        formatBytes(residentBytes()).c_str(),
+        formatBytes(usage.cells).c_str(), formatBytes(usage.text).c_str(), formatBytes(usage.formulas).c_str(),
+        formatBytes(usage.indexes).c_str(), formatBytes(usage.caches).c_str());
+    return true;
+}
+
+template <typename Step>
+static bool runAlone(Step step) {
+#ifdef _WIN32
+    return step();
+#else
+    std::fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) return step();
+    if (child == 0) {
+        bool ok = step();
+        std::fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    return waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+static void run(size_t sheets, size_t cellsPerSheet, size_t cacheLimit) {
+    if (!runAlone([&] { return writeWorkbook(sheets, cellsPerSheet); })) {
+        std::fprintf(stderr, "cannot write %s\n", BENCH_FILE);
+        return;
+    }
+    runAlone([&] { return measure(sheets, cacheLimit); });
+}
+
+int main() {
+    const size_t sheetCells = static_cast<size_t>(MAX_ROWS) * MAX_COLS;
+
+    std::printf("%9s %6s %6s %9s %6s %9s %6s %9s | %8s %8s %8s %8s %8s\n",
+        "cells", "sheets", "loaded", "tracked", "B/cell", "heap", "B/cell", "RSS",
+        "cells", "text", "formulas", "indexes", "caches");
+    for (size_t cells = 1024; cells < sheetCells; cells *= 4) {
+        run(1, cells, 0);
+    }
+    for (size_t sheets = 1; sheets <= 64; sheets *= 4) {
+        run(sheets, sheetCells, 0);
+    }
+    run(64, sheetCells, 4);
+    std::remove(BENCH_FILE);
+    return 0;
+}
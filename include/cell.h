@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory_resource>
 #include <string>
 
 constexpr int MAX_ROWS = 256;
@@ -12,11 +13,34 @@ enum class CellType {
     Repeating
 };
 
+inline char cellTypeChar(CellType type) {
+    switch (type) {
+        case CellType::Value: return 'V';
+        case CellType::Label: return 'L';
+        case CellType::Repeating: return 'R';
+        default: return 'E';
+    }
+}
+
 struct Cell {
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
     CellType type = CellType::Empty;
-    std::string text;
+    std::pmr::string text;
     double numericValue = 0.0;
-    std::string format = "   ";
+    std::pmr::string format{"   "};
+
+    Cell() = default;
+    Cell(const Cell&) = default;
+    Cell(Cell&&) = default;
+    Cell& operator=(const Cell&) = default;
+    Cell& operator=(Cell&&) = default;
+
+    explicit Cell(const allocator_type& alloc) : text(alloc), format("   ", alloc) {}
+    Cell(const Cell& other, const allocator_type& alloc)
+        : type(other.type), text(other.text, alloc), numericValue(other.numericValue), format(other.format, alloc) {}
+    Cell(Cell&& other, const allocator_type& alloc)
+        : type(other.type), text(std::move(other.text), alloc), numericValue(other.numericValue), format(std::move(other.format), alloc) {}
 
     bool isEmpty() const { return type == CellType::Empty; }
 
@@ -48,7 +72,7 @@ struct Cell {
         return numericValue;
     }
 
-    const std::string& getText() const {
+    const std::pmr::string& getText() const {
         return text;
     }
 
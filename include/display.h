@@ -1,9 +1,9 @@
 #pragma once
 
+#include "layout.h"
 #include <string>
 
 constexpr int ROW_LABEL_WIDTH = 3;
-constexpr int DEFAULT_COL_WIDTH = 9;
 constexpr int HEADER_ROWS = 4;
 
 enum class EditMode {
@@ -23,7 +23,22 @@ enum class InputType {
     SaveFilename,
     LoadFilename,
     DeleteFilename,
-    DeleteConfirm
+    DeleteConfirm,
+    SheetName,
+    Global,
+    GlobalWidth,
+    GlobalRecalc,
+    GlobalIteration,
+    MemoryInfo,
+    ColumnWidth,
+    DataTable,
+    Find
+};
+
+enum class RenderMode {
+    Terminal,
+    None,
+    Buffer
 };
 
 struct SpreadsheetView {
@@ -34,8 +49,12 @@ struct SpreadsheetView {
     EditMode mode = EditMode::Normal;
     InputType inputType = InputType::None;
     std::string inputBuffer;
+    std::string lastSearch;
 };
 
+void setRenderMode(RenderMode mode);
+void setScreenSize(int rows, int cols);
+std::string screenSnapshot();
 void getTerminalSize(int& rows, int& cols);
 void clearScreen();
 void moveCursor(int row, int col);
@@ -43,7 +62,10 @@ void setReverse(bool on);
 void hideCursor();
 void showCursor();
 void drawSpreadsheetScreen(const SpreadsheetView& view, const class Matrix& matrix);
+void drawCalcIndicator(const class Matrix& matrix);
+std::string calcIndicator(const class Matrix& matrix);
 int visibleRows();
-int visibleCols();
+int visibleWidth();
+int visibleCols(const class Matrix& matrix, int scrollCol);
 std::string columnLabel(int col);
 bool parseAddress(const std::string& addr, int& row, int& col);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+constexpr int DEFAULT_COL_WIDTH = 9;
+constexpr int MIN_COL_WIDTH = 1;
+constexpr int MAX_COL_WIDTH = 72;
+
+class ColumnLayout {
+public:
+    explicit ColumnLayout(int columns);
+
+    int columnCount() const { return static_cast<int>(widths.size()); }
+    int defaultWidth() const { return globalWidth; }
+    int width(int col) const { return widths[col]; }
+    bool hasOverride(int col) const { return overrides[col] != 0; }
+
+    void setDefaultWidth(int width);
+    void setWidth(int col, int width);
+    void reset();
+
+    long long offset(int col) const;
+    int columnAt(long long x) const;
+    int fittingColumns(int first, int screenWidth) const;
+    int scrollToShow(int col, int screenWidth) const;
+    size_t memoryUsage() const;
+
+private:
+    void rebuild();
+    int search(long long x) const;
+
+    int globalWidth = DEFAULT_COL_WIDTH;
+    std::vector<int> widths;
+    std::vector<int> overrides;
+    std::vector<long long> tree;
+};
@@ -1,7 +1,18 @@
 #pragma once
 
 #include "cell.h"
+#include "layout.h"
+#include "memory.h"
+#include "occupancy.h"
+#include "parser.h"
+#include "search.h"
+#include <iosfwd>
+#include <map>
+#include <memory_resource>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 enum class CalcMode {
     Column,
@@ -9,10 +20,50 @@ enum class CalcMode {
     Recalculating
 };
 
+constexpr size_t RECALC_BATCH = 256;
+constexpr int DEFAULT_MAX_ITERATIONS = 100;
+constexpr int MAX_ITERATIONS = 10000;
+constexpr double DEFAULT_ITERATION_TOLERANCE = 0.001;
+
+struct SheetImage {
+    bool manualRecalc = false;
+    int maxIterations = DEFAULT_MAX_ITERATIONS;
+    double iterationTolerance = DEFAULT_ITERATION_TOLERANCE;
+    int defaultWidth = DEFAULT_COL_WIDTH;
+    std::vector<std::pair<int, int>> widths;
+    std::vector<std::pair<int, Cell>> cells;
+};
+
+bool readSheetImage(std::istream& in, SheetImage& image);
+
+struct AggregateState {
+    double sum = 0.0;
+    int count = 0;
+    std::map<double, int> values;
+    size_t cells = 0;
+    size_t updates = 0;
+    bool stale = true;
+
+    double minValue() const { return values.empty() ? 0.0 : values.begin()->first; }
+    double maxValue() const { return values.empty() ? 0.0 : values.rbegin()->first; }
+};
+
 class Matrix {
 public:
     CalcMode calcMode = CalcMode::Column;
+    bool manualRecalc = false;
     std::string filename;
+    std::string sheetName;
+    class Workbook* workbook = nullptr;
+    int maxIterations = DEFAULT_MAX_ITERATIONS;
+    double iterationTolerance = DEFAULT_ITERATION_TOLERANCE;
+    unsigned tableWorkers = 0;
+    ColumnLayout columnLayout{MAX_COLS};
+
+    Matrix();
+    explicit Matrix(const Matrix* base);
+    Matrix(const Matrix&) = delete;
+    Matrix& operator=(const Matrix&) = delete;
 
     Cell* getCellPtr(int row, int col);
     const Cell* getCellPtr(int row, int col) const;
@@ -24,16 +75,147 @@ public:
     bool saveToFile(const std::string& fname);
     bool saveToFile();
     bool loadFromFile(const std::string& fname);
+    void saveToStream(std::ostream& out) const;
+    void loadFromStream(std::istream& in);
+    size_t mergeImage(const SheetImage& image);
+    void markSaved(const std::string& body);
+    std::string savedBase() const;
+    void restoreSavedBase(const std::string& base);
+
+    const Matrix* referencedSheet(const RangeRef& ref) const;
+    const AggregateState* rangeAggregate(const RangeRef& ref) const;
+    const AggregateState* sourceAggregate(const Matrix* source, const RangeRef& ref) const;
+
+    void beginTransaction();
+    void commitTransaction(bool recalc = true);
+    bool inTransaction() const { return transactionDepth > 0; }
+
+    void setIteration(int limit, double tolerance);
+    void recalculate();
+    void recalculateWindow(int row, int col, int rows, int cols);
+    bool recalcStep(size_t budget);
+    bool needsRecalc() const { return !dirty.empty(); }
+    int recalcProgress() const;
+    std::vector<std::pair<int, int>> pendingCells() const;
+    CalcMode calcOrder() const { return calcMode == CalcMode::Recalculating ? recalcOrder : calcMode; }
+
+    bool findNext(const std::string& query, int& row, int& col) const;
+
+    bool dataTable(const RangeRef& table, const RangeRef& input);
+    bool dataTable(const RangeRef& table, const RangeRef& rowInput, const RangeRef& columnInput);
+
+    bool rowOccupied(int row) const { return occupancy.rowOccupied(row); }
+    int jumpInRow(int row, int col, int step) const { return occupancy.jumpInRow(row, col, step); }
+    int jumpInCol(int row, int col, int step) const { return occupancy.jumpInCol(row, col, step); }
+    int lastUsedRow() const { return occupancy.lastRow(); }
+    int lastUsedCol() const { return occupancy.lastCol(); }
 
     int getRowCount() const { return MAX_ROWS; }
     int getColCount() const { return MAX_COLS; }
-    size_t usedCellCount() const { return cells.size(); }
+    size_t usedCellCount() const { return cells->size(); }
+    MemoryUsage memoryUsage() const;
 
 private:
+    using CellMap = std::pmr::unordered_map<int, Cell>;
+
     static constexpr int cellKey(int row, int col) {
         return row * MAX_COLS + col;
     }
 
-    std::unordered_map<int, Cell> cells;
+    static constexpr long long rangeKey(const RangeRef& ref) {
+        return static_cast<long long>(cellKey(ref.row1, ref.col1)) * MAX_ROWS * MAX_COLS + cellKey(ref.row2, ref.col2);
+    }
+
+    static constexpr bool rangeContains(long long range, int key) {
+        int first = static_cast<int>(range / (MAX_ROWS * MAX_COLS));
+        int last = static_cast<int>(range % (MAX_ROWS * MAX_COLS));
+        int row = key / MAX_COLS;
+        int col = key % MAX_COLS;
+        return row >= first / MAX_COLS && row <= last / MAX_COLS && col >= first % MAX_COLS && col <= last % MAX_COLS;
+    }
+
+    struct AggregateEntry {
+        RangeRef ref;
+        AggregateState state;
+        int refs = 0;
+    };
+
+    struct DependencyGraph {
+        using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+        explicit DependencyGraph(const allocator_type& alloc)
+            : precedents(alloc), dependents(alloc), externalPrecedents(alloc), externalDependents(alloc), formulaRanges(alloc), rangeDependents(alloc), columnRanges(alloc) {}
+
+        std::pmr::unordered_map<int, std::pmr::vector<int>> precedents;
+        std::pmr::unordered_map<int, std::pmr::unordered_set<int>> dependents;
+        std::pmr::unordered_map<int, std::pmr::vector<std::pair<std::pmr::string, int>>> externalPrecedents;
+        std::pmr::unordered_map<std::pmr::string, std::pmr::unordered_map<int, std::pmr::unordered_set<int>>> externalDependents;
+        std::pmr::unordered_map<int, std::pmr::vector<long long>> formulaRanges;
+        std::pmr::unordered_map<long long, std::pmr::unordered_set<int>> rangeDependents;
+        std::pmr::unordered_map<int, std::pmr::vector<long long>> columnRanges;
+    };
+
+    struct ArrayFormula {
+        ArrayProgram program;
+        std::vector<double> values;
+        std::vector<int> spill;
+    };
+
+    friend class Workbook;
+
+    void cellChanged(int key);
+    void updateDependencies(int key, const Cell* cell);
+    void markExternalDirty(const std::string& sheet, int key);
+    void markExternalSheetDirty(const std::string& sheet);
+    void markDirty(int key);
+    void appendDependents(int key, std::vector<int>& out) const;
+    void dirtyInRange(long long range, std::vector<int>& out) const;
+    void evaluate(int key);
+    bool evaluateCell(int key, double& delta);
+    void solveComponent(std::vector<int>& component);
+    void sortByCalcOrder(std::vector<int>& keys) const;
+    void indexCell(int key, const Cell& cell, bool add);
+    void retainAggregate(long long range, const RangeRef& ref);
+    void releaseAggregate(long long range);
+    void updateAggregates(int key, bool hadValue, double oldValue, bool hasValue, double newValue);
+    void updateCalcState();
+    void setMergeBase(const SheetImage& image);
+    void detachCell(int key);
+    void placeSpill(int anchor);
+    void releaseSpill(int anchor);
+    CellMap* createCellMap();
+    DependencyGraph* createGraph();
+    bool runDataTable(const RangeRef& table, int rowInput, int columnInput);
+    std::unordered_set<int> dependentClosure(const std::vector<int>& keys) const;
+    std::vector<int> dependentOrder(const std::vector<int>& inputs, size_t& acyclic) const;
+    const AggregateState* cachedAggregate(const RangeRef& ref) const;
+    void prepareReferences(int key, std::unordered_map<std::string, const Matrix*>& sheets);
+    void overrideValue(int key, double value);
+    double overlayValue(int key);
+    void evaluateOverlay(const std::vector<int>& order, size_t acyclic);
+
+    const Matrix* base = nullptr;
+    std::unordered_map<std::string, const Matrix*> overlaySheets;
+    CountingResource cellUsage;
+    std::pmr::unsynchronized_pool_resource cellArena{&cellUsage};
+    CellMap* cells;
+    CountingResource graphUsage;
+    std::pmr::unsynchronized_pool_resource graphArena{&graphUsage};
+    DependencyGraph* graph;
+    mutable std::unordered_map<long long, AggregateEntry> aggregates;
+    std::unordered_map<int, ArrayFormula> arrays;
+    std::unordered_map<int, int> spillAnchors;
+    SearchIndex searchIndex;
+    Occupancy occupancy{MAX_ROWS, MAX_COLS};
+    std::unordered_set<int> dirty;
+    std::unordered_set<int> evaluating;
+    std::vector<int> recalcQueue;
+    size_t recalcQueuePos = 0;
+    size_t recalcTotal = 0;
+    CalcMode recalcOrder = CalcMode::Column;
+    int transactionDepth = 0;
+    std::unordered_set<int> transactionKeys;
+    SheetImage savedSettings;
+    std::unordered_map<int, size_t> savedCells;
     static Cell emptyCell;
 };
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory_resource>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct MemoryUsage {
+    size_t cells = 0;
+    size_t text = 0;
+    size_t formulas = 0;
+    size_t indexes = 0;
+    size_t caches = 0;
+    size_t cellCount = 0;
+
+    size_t total() const { return cells + text + formulas + indexes + caches; }
+    size_t bytesPerCell() const { return cellCount > 0 ? total() / cellCount : 0; }
+
+    MemoryUsage& operator+=(const MemoryUsage& other);
+};
+
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) : upstream(upstream) {}
+
+    size_t allocated() const { return current; }
+    size_t peak() const { return highest; }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    std::pmr::memory_resource* upstream;
+    size_t current = 0;
+    size_t highest = 0;
+};
+
+constexpr size_t SSO_CAPACITY = 15;
+constexpr size_t TREE_NODE_OVERHEAD = 4 * sizeof(void*);
+constexpr size_t HASH_NODE_OVERHEAD = 2 * sizeof(void*);
+
+template <typename Char, typename Traits, typename Alloc>
+size_t stringBytes(const std::basic_string<Char, Traits, Alloc>& text) {
+    return text.capacity() > SSO_CAPACITY ? (text.capacity() + 1) * sizeof(Char) : 0;
+}
+
+template <typename T, typename Alloc>
+size_t vectorBytes(const std::vector<T, Alloc>& items) {
+    return items.capacity() * sizeof(T);
+}
+
+template <typename Key, typename Compare, typename Alloc>
+size_t treeBytes(const std::set<Key, Compare, Alloc>& items) {
+    return items.size() * (sizeof(Key) + TREE_NODE_OVERHEAD);
+}
+
+template <typename Key, typename Value, typename Compare, typename Alloc>
+size_t treeBytes(const std::map<Key, Value, Compare, Alloc>& items) {
+    return items.size() * (sizeof(std::pair<const Key, Value>) + TREE_NODE_OVERHEAD);
+}
+
+template <typename Key, typename Hash, typename Equal, typename Alloc>
+size_t hashBytes(const std::unordered_set<Key, Hash, Equal, Alloc>& items) {
+    return items.bucket_count() * sizeof(void*) + items.size() * (sizeof(Key) + HASH_NODE_OVERHEAD);
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal, typename Alloc>
+size_t hashBytes(const std::unordered_map<Key, Value, Hash, Equal, Alloc>& items) {
+    return items.bucket_count() * sizeof(void*) + items.size() * (sizeof(std::pair<const Key, Value>) + HASH_NODE_OVERHEAD);
+}
+
+std::string formatBytes(size_t bytes);
+size_t residentBytes();
+size_t heapAllocatedBytes();
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Occupancy {
+public:
+    Occupancy(int rows, int cols);
+
+    void set(int row, int col, bool occupied);
+    void clear();
+
+    bool test(int row, int col) const;
+    bool rowOccupied(int row) const;
+    int lastRow() const;
+    int lastCol() const;
+
+    int jumpInRow(int row, int col, int step) const;
+    int jumpInCol(int row, int col, int step) const;
+    bool next(int& row, int& col) const;
+    size_t memoryUsage() const;
+
+private:
+    const uint64_t* rowWords(int row) const { return &rowBits[static_cast<size_t>(row) * rowStride]; }
+    const uint64_t* colWords(int col) const { return &colBits[static_cast<size_t>(col) * colStride]; }
+
+    int rows;
+    int cols;
+    int rowStride;
+    int colStride;
+    std::vector<uint64_t> rowBits;
+    std::vector<uint64_t> colBits;
+    std::vector<int> rowCounts;
+    std::vector<int> colCounts;
+    std::vector<uint64_t> rowSummary;
+    std::vector<uint64_t> colSummary;
+};
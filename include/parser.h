@@ -1,7 +1,59 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
 
 class Matrix;
 
-double parseValue(const std::string& text, const Matrix& matrix);
+struct RangeRef {
+    std::string sheet;
+    int row1 = 0;
+    int col1 = 0;
+    int row2 = 0;
+    int col2 = 0;
+};
+
+enum class ArrayOpCode {
+    Number,
+    Range,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Power,
+    Negate,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Equal,
+    NotEqual,
+    If,
+    Abs,
+    Int,
+    Sqrt
+};
+
+struct ArrayOp {
+    ArrayOpCode code = ArrayOpCode::Number;
+    double number = 0.0;
+    int ref = -1;
+};
+
+struct ArrayProgram {
+    std::vector<ArrayOp> ops;
+    std::vector<RangeRef> refs;
+    int rows = 1;
+    int cols = 1;
+    int depth = 0;
+    bool valid = false;
+};
+
+double parseValue(std::string_view text, const Matrix& matrix);
+void collectReferences(std::string_view text, std::vector<RangeRef>& refs);
+bool parseRangeAddress(std::string_view text, RangeRef& range);
+bool isValueTrigger(int ch);
+bool isArrayFormula(std::string_view text);
+bool compileArray(std::string_view text, ArrayProgram& program);
+void evaluateArray(const ArrayProgram& program, const Matrix& matrix, std::vector<double>& values);
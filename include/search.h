@@ -0,0 +1,48 @@
+#pragma once
+
+#include "memory.h"
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class SearchIndex {
+public:
+    SearchIndex();
+    SearchIndex(const SearchIndex&) = delete;
+    SearchIndex& operator=(const SearchIndex&) = delete;
+
+    void addLabel(int key, std::string_view text);
+    void removeLabel(int key);
+    void addValue(int key, double value);
+    void removeValue(int key, double value);
+    void clear();
+
+    bool findNext(const std::string& query, int afterKey, bool columnOrder, int& result) const;
+    size_t memoryUsage() const;
+
+private:
+    struct Postings {
+        using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+        explicit Postings(const allocator_type& alloc) : grams(alloc), labels(alloc), values(alloc) {}
+
+        std::pmr::unordered_map<uint32_t, std::pmr::vector<int>> grams;
+        std::pmr::unordered_map<int, std::pmr::string> labels;
+        std::pmr::map<double, std::pmr::vector<int>> values;
+    };
+
+    Postings* createPostings();
+    void addGram(uint32_t gram, int key);
+    void removeGram(uint32_t gram, int key);
+    const std::pmr::vector<int>* labelCandidates(const std::string& query) const;
+    bool nextIn(const std::pmr::vector<int>& keys, const std::string* query, int afterKey, bool columnOrder, int& result) const;
+    bool nextLabel(const std::string& query, int afterKey, bool columnOrder, int& result) const;
+
+    CountingResource usage;
+    std::pmr::unsynchronized_pool_resource arena{&usage};
+    Postings* index;
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+constexpr int SNAPSHOT_CHUNK_ROWS = 16;
+constexpr size_t CLIENT_OUTBOX_LIMIT = 1 << 20;
+
+int runServer(const std::string& socketPath, const std::string& filename);
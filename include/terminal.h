@@ -1,13 +1,29 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
+
 void initTerminal();
 void restoreTerminal();
 int getKey();
+bool keyPending();
+bool waitForKey(int timeoutMs);
+bool openKeyScript(const std::string& path);
+size_t keyScriptKeys();
 
+constexpr int KEY_EOF = -1;
+constexpr int KEY_CTRL_F = 6;
+constexpr int KEY_CTRL_N = 14;
 constexpr int KEY_ESC = 27;
 constexpr int KEY_ARROW_UP = 1000;
 constexpr int KEY_ARROW_DOWN = 1001;
 constexpr int KEY_ARROW_RIGHT = 1002;
 constexpr int KEY_ARROW_LEFT = 1003;
+constexpr int KEY_CTRL_UP = 1004;
+constexpr int KEY_CTRL_DOWN = 1005;
+constexpr int KEY_CTRL_RIGHT = 1006;
+constexpr int KEY_CTRL_LEFT = 1007;
+constexpr int KEY_HOME = 1008;
+constexpr int KEY_END = 1009;
 constexpr int KEY_F1 = 1010;
 constexpr int KEY_F2 = 1011;
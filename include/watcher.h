@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+struct FileStamp {
+    std::filesystem::file_time_type lastWrite;
+    std::uintmax_t size = 0;
+    std::size_t hash = 0;
+
+    bool operator==(const FileStamp& other) const { return lastWrite == other.lastWrite && size == other.size && hash == other.hash; }
+};
+
+bool readFileInfo(const std::string& path, FileStamp& stamp);
+bool readFileStamp(const std::string& path, FileStamp& stamp);
+
+class FileWatcher {
+public:
+    FileWatcher() = default;
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+    ~FileWatcher();
+
+    bool watch(const std::string& path);
+    void stop();
+    bool changed();
+    const std::string& path() const { return watched; }
+
+private:
+    std::string watched;
+    std::string name;
+    int fd = -1;
+    int wd = -1;
+    std::filesystem::file_time_type lastWrite;
+    std::uintmax_t lastSize = 0;
+    bool existed = false;
+};
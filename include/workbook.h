@@ -0,0 +1,108 @@
+#pragma once
+
+#include "matrix.h"
+#include "watcher.h"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+constexpr size_t DEFAULT_SHEET_CACHE = 16;
+constexpr long long PAGE_COMPACT_BYTES = 1 << 16;
+
+struct WorkbookImage {
+    struct Sheet {
+        std::string name;
+        long long offset = 0;
+        long long length = 0;
+        size_t hash = 0;
+        SheetImage image;
+    };
+
+    std::string filename;
+    std::vector<Sheet> sheets;
+    long long dataStart = 0;
+    FileStamp stamp;
+    bool ok = false;
+};
+
+class Workbook {
+public:
+    std::string filename;
+    size_t sheetCacheLimit = DEFAULT_SHEET_CACHE;
+
+    Workbook();
+    Workbook(const Workbook&) = delete;
+    Workbook& operator=(const Workbook&) = delete;
+
+    size_t sheetCount() const { return sheets.size(); }
+    size_t activeIndex() const { return active; }
+    const std::string& sheetName(size_t index) const { return sheets[index].name; }
+    bool isLoaded(size_t index) const { return sheets[index].loaded; }
+    bool isPaged(size_t index) const { return sheets[index].paged; }
+    size_t loadedSheetCount() const { return loadedCount; }
+    long long pageFileSize() const;
+
+    Matrix& activeSheet();
+    Matrix& sheetAt(size_t index);
+    Matrix* sheet(const std::string& name);
+    int findSheet(const std::string& name) const;
+    bool addSheet(const std::string& name);
+    void selectSheet(size_t index);
+
+    bool saveToFile(const std::string& fname);
+    bool saveToFile();
+    bool loadFromFile(const std::string& fname);
+    static bool readImage(const std::string& fname, WorkbookImage& image);
+    size_t applyImage(const WorkbookImage& image);
+
+    void markReferencesDirty(const Matrix& source, int key);
+    void markSheetDirty(const Matrix& source);
+    size_t trimCache();
+    MemoryUsage memoryUsage() const;
+
+private:
+    struct Sheet {
+        std::string name;
+        std::unique_ptr<Matrix> matrix;
+        long long offset = 0;
+        long long length = 0;
+        long long baseLength = 0;
+        long long pageSlot = 0;
+        bool loaded = true;
+        bool paged = false;
+        bool stale = false;
+        size_t bodyHash = 0;
+        unsigned long long lastUse = 0;
+        std::unordered_map<std::string, std::unordered_set<int>> watched;
+    };
+
+    struct FileCloser {
+        void operator()(std::FILE* file) const { std::fclose(file); }
+    };
+
+    Sheet& createSheet(const std::string& name);
+    void evictSheet(Sheet& sheet);
+    void markEvictedDirty(Sheet& evicted);
+    bool writePage(Sheet& sheet, const std::string& data);
+    void releasePage(Sheet& sheet);
+    bool compactPages();
+    Matrix& ensureLoaded(Sheet& sheet);
+    bool readSheetData(const Sheet& sheet, std::string& data);
+    bool refreshSource();
+    void reindex(const std::vector<WorkbookImage::Sheet>& index);
+    bool readPage(long long offset, long long length, std::string& data) const;
+    void reset();
+
+    std::vector<Sheet> sheets;
+    size_t active = 0;
+    size_t loadedCount = 0;
+    std::string sourceFile;
+    FileStamp sourceStamp;
+    long long dataStart = 0;
+    unsigned long long useClock = 0;
+    long long pageDead = 0;
+    std::unique_ptr<std::FILE, FileCloser> pageFile;
+};
@@ -1,9 +1,135 @@
 #include "display.h"
 #include "matrix.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <iomanip>
 #include <sstream>
+#include <vector>
+
+class ScreenBuffer : public std::streambuf {
+public:
+    void resize(int rows, int cols) {
+        width = cols;
+        grid.assign(rows, std::string(cols, ' '));
+        row = 0;
+        col = 0;
+    }
+
+    std::string snapshot() const {
+        std::string result;
+        for (const std::string& line : frame) {
+            size_t end = line.find_last_not_of(' ');
+            result += end == std::string::npos ? "" : line.substr(0, end + 1);
+            result += '\n';
+        }
+        return result;
+    }
+
+    void present() {
+        frame = grid;
+    }
+
+protected:
+    int overflow(int ch) override {
+        if (ch == EOF) return 0;
+        put(static_cast<char>(ch));
+        return ch;
+    }
+
+    std::streamsize xsputn(const char* text, std::streamsize count) override {
+        for (std::streamsize i = 0; i < count; i++) {
+            put(text[i]);
+        }
+        return count;
+    }
+
+private:
+    void put(char c) {
+        if (escape) {
+            sequence += c;
+            if (std::isalpha(static_cast<unsigned char>(c))) {
+                apply();
+                escape = false;
+            }
+        } else if (c == '\033') {
+            escape = true;
+            sequence.clear();
+        } else if (c == '\n') {
+            row++;
+            col = 0;
+        } else {
+            if (row >= 0 && row < static_cast<int>(grid.size()) && col >= 0 && col < width) {
+                grid[row][col] = c;
+            }
+            col++;
+        }
+    }
+
+    void apply() {
+        char command = sequence.back();
+        if (command == 'J') {
+            for (std::string& line : grid) line.assign(width, ' ');
+        } else if (command == 'H') {
+            int r = 1;
+            int c = 1;
+            size_t semicolon = sequence.find(';');
+            if (semicolon != std::string::npos) {
+                r = std::atoi(sequence.c_str() + 1);
+                c = std::atoi(sequence.c_str() + semicolon + 1);
+            }
+            row = r - 1;
+            col = c - 1;
+        }
+    }
+
+    std::vector<std::string> grid;
+    std::vector<std::string> frame;
+    std::string sequence;
+    int width = 0;
+    int row = 0;
+    int col = 0;
+    bool escape = false;
+};
+
+static RenderMode mode = RenderMode::Terminal;
+static int fixedRows = 0;
+static int fixedCols = 0;
+static ScreenBuffer buffer;
+static std::ostream bufferStream(&buffer);
+static std::ostream nullStream(nullptr);
+
+static std::ostream& screen() {
+    switch (mode) {
+        case RenderMode::Terminal: return std::cout;
+        case RenderMode::Buffer: return bufferStream;
+        case RenderMode::None: break;
+    }
+    return nullStream;
+}
+
+void setRenderMode(RenderMode renderMode) {
+    mode = renderMode;
+    if (mode == RenderMode::Buffer) {
+        int rows, cols;
+        getTerminalSize(rows, cols);
+        buffer.resize(rows, cols);
+    }
+}
+
+void setScreenSize(int rows, int cols) {
+    fixedRows = rows;
+    fixedCols = cols;
+    if (mode == RenderMode::Buffer) {
+        buffer.resize(rows, cols);
+    }
+}
+
+std::string screenSnapshot() {
+    return buffer.snapshot();
+}
 
 std::string columnLabel(int col) {
     std::string label;
@@ -45,6 +171,11 @@ bool parseAddress(const std::string& addr, int& row, int& col) {
 #include <windows.h>
 
 void getTerminalSize(int& rows, int& cols) {
+    if (fixedRows > 0 && fixedCols > 0) {
+        rows = fixedRows;
+        cols = fixedCols;
+        return;
+    }
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
     cols = csbi.srWindow.Right - csbi.srWindow.Left + 1;
@@ -56,7 +187,12 @@ void getTerminalSize(int& rows, int& cols) {
 #include <unistd.h>
 
 void getTerminalSize(int& rows, int& cols) {
-    struct winsize w;
+    if (fixedRows > 0 && fixedCols > 0) {
+        rows = fixedRows;
+        cols = fixedCols;
+        return;
+    }
+    struct winsize w = {24, 80, 0, 0};
     ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
     rows = w.ws_row;
     cols = w.ws_col;
@@ -65,27 +201,27 @@ void getTerminalSize(int& rows, int& cols) {
 #endif
 
 void clearScreen() {
-    std::cout << "\033[2J\033[H" << std::flush;
+    screen() << "\033[2J\033[H" << std::flush;
 }
 
 void moveCursor(int row, int col) {
-    std::cout << "\033[" << row << ";" << col << "H" << std::flush;
+    screen() << "\033[" << row << ";" << col << "H" << std::flush;
 }
 
 void setReverse(bool on) {
     if (on) {
-        std::cout << "\033[7m";
+        screen() << "\033[7m";
     } else {
-        std::cout << "\033[0m";
+        screen() << "\033[0m";
     }
 }
 
 void hideCursor() {
-    std::cout << "\033[?25l" << std::flush;
+    screen() << "\033[?25l" << std::flush;
 }
 
 void showCursor() {
-    std::cout << "\033[?25h" << std::flush;
+    screen() << "\033[?25h" << std::flush;
 }
 
 int visibleRows() {
@@ -94,15 +230,52 @@ int visibleRows() {
     return termRows - HEADER_ROWS;
 }
 
-int visibleCols() {
+int visibleWidth() {
+    int termRows, termCols;
+    getTerminalSize(termRows, termCols);
+    return termCols - ROW_LABEL_WIDTH;
+}
+
+int visibleCols(const Matrix& matrix, int scrollCol) {
+    return matrix.columnLayout.fittingColumns(scrollCol, visibleWidth());
+}
+
+std::string calcIndicator(const Matrix& matrix) {
+    if (matrix.manualRecalc) {
+        return matrix.needsRecalc() ? "M !" : "M";
+    }
+    switch (matrix.calcMode) {
+        case CalcMode::Column: return "C";
+        case CalcMode::Row: return "R";
+        case CalcMode::Recalculating: return std::to_string(matrix.recalcProgress()) + "% !";
+    }
+    return "C";
+}
+
+void drawCalcIndicator(const Matrix& matrix) {
+    if (mode == RenderMode::None) return;
     int termRows, termCols;
     getTerminalSize(termRows, termCols);
-    return (termCols - ROW_LABEL_WIDTH) / DEFAULT_COL_WIDTH;
+
+    std::string indicator = " " + calcIndicator(matrix) + " ";
+    int width = std::max((int)indicator.length(), 7);
+    if (width > termCols) return;
+    indicator = std::string(width - indicator.length(), ' ') + indicator;
+
+    moveCursor(1, termCols - width + 1);
+    setReverse(true);
+    screen() << indicator;
+    setReverse(false);
+    moveCursor(1, 1);
+    screen() << std::flush;
+    buffer.present();
 }
 
 void drawSpreadsheetScreen(const SpreadsheetView& view, const Matrix& matrix) {
+    if (mode == RenderMode::None) return;
     int termRows, termCols;
     getTerminalSize(termRows, termCols);
+    const ColumnLayout& layout = matrix.columnLayout;
 
     clearScreen();
 
@@ -139,34 +312,47 @@ void drawSpreadsheetScreen(const SpreadsheetView& view, const Matrix& matrix) {
                 }
             }
 
-            char calcChar = 'C';
-            switch (matrix.calcMode) {
-                case CalcMode::Column: calcChar = 'C'; break;
-                case CalcMode::Row: calcChar = 'R'; break;
-                case CalcMode::Recalculating: calcChar = '!'; break;
-            }
+            std::string indicator = calcIndicator(matrix);
 
             std::string line = " " + coord + " " + formatStr + "   (" + typeChar + ")   " + contentStr;
-            int endLen = 2;
+            int endLen = (int)indicator.length() + 1;
             int maxContent = termCols - endLen - (int)line.length();
             if (maxContent < 0) {
-                line = line.substr(0, termCols - endLen);
+                line = line.substr(0, std::max(termCols - endLen, 0));
             } else {
                 line += std::string(maxContent, ' ');
             }
-            line += calcChar;
+            line += indicator;
             line += ' ';
 
-            std::cout << line;
+            screen() << line;
         } else if (row == 2) {
             setReverse(true);
             std::string row2Content;
             if (view.inputType == InputType::Command) {
-                row2Content = "COMMAND: BCDEFGIMPRSTVW-";
+                row2Content = "COMMAND: BCDEFGIMNPRSTVWX-";
             } else if (view.inputType == InputType::Storage) {
                 row2Content = "STORAGE:   L S D I Q #";
             } else if (view.inputType == InputType::SaveFilename || view.inputType == InputType::LoadFilename || view.inputType == InputType::DeleteFilename) {
                 row2Content = "Type the file name";
+            } else if (view.inputType == InputType::SheetName) {
+                row2Content = "Type the sheet name";
+            } else if (view.inputType == InputType::Find) {
+                row2Content = "Find";
+            } else if (view.inputType == InputType::DataTable) {
+                row2Content = "Data table: range,input or range,row input,column input";
+            } else if (view.inputType == InputType::Global) {
+                row2Content = "GLOBAL: C I M R W";
+            } else if (view.inputType == InputType::MemoryInfo) {
+                row2Content = "MEMORY";
+            } else if (view.inputType == InputType::GlobalRecalc) {
+                row2Content = "RECALC: A M";
+            } else if (view.inputType == InputType::GlobalIteration) {
+                row2Content = "Iteration limit,tolerance";
+            } else if (view.inputType == InputType::GlobalWidth) {
+                row2Content = "Column width";
+            } else if (view.inputType == InputType::ColumnWidth) {
+                row2Content = "Width of column " + columnLabel(view.cursorCol) + " (0 for global)";
             } else if (view.inputType == InputType::DeleteConfirm) {
                 row2Content = "Are you sure you want to delete '" + view.inputBuffer + "'?";
             } else if (view.mode == EditMode::Editing) {
@@ -177,53 +363,62 @@ void drawSpreadsheetScreen(const SpreadsheetView& view, const Matrix& matrix) {
                     default: break;
                 }
             }
-            std::cout << row2Content;
+            std::string sheetLabel = matrix.sheetName.empty() ? "" : matrix.sheetName + " ";
+            if ((int)(row2Content.length() + sheetLabel.length()) < termCols) {
+                row2Content += std::string(termCols - row2Content.length() - sheetLabel.length(), ' ') + sheetLabel;
+            }
+            screen() << row2Content;
             for (size_t col = row2Content.length() + 1; col <= (size_t)termCols; col++) {
-                std::cout << ' ';
+                screen() << ' ';
             }
         } else if (row == 3) {
             setReverse(false);
-            if (view.mode == EditMode::Editing || view.inputType == InputType::Goto || view.inputType == InputType::SaveFilename || view.inputType == InputType::LoadFilename || view.inputType == InputType::DeleteFilename) {
-                std::cout << view.inputBuffer;
+            if (view.mode == EditMode::Editing || view.inputType == InputType::Goto || view.inputType == InputType::SaveFilename || view.inputType == InputType::LoadFilename || view.inputType == InputType::DeleteFilename || view.inputType == InputType::SheetName || view.inputType == InputType::GlobalWidth || view.inputType == InputType::ColumnWidth || view.inputType == InputType::GlobalIteration || view.inputType == InputType::Find || view.inputType == InputType::DataTable || view.inputType == InputType::MemoryInfo) {
+                screen() << view.inputBuffer;
                 for (size_t col = view.inputBuffer.length() + 1; col <= (size_t)termCols; col++) {
-                    std::cout << ' ';
+                    screen() << ' ';
                 }
             } else {
                 for (int col = 1; col <= termCols; col++) {
-                    std::cout << ' ';
+                    screen() << ' ';
                 }
             }
         } else if (row == 4) {
             setReverse(true);
-            std::cout << std::string(ROW_LABEL_WIDTH, ' ');
+            screen() << std::string(ROW_LABEL_WIDTH, ' ');
 
             int sheetCol = view.scrollCol;
             int screenCol = ROW_LABEL_WIDTH + 1;
-            while (screenCol + DEFAULT_COL_WIDTH <= termCols + 1) {
+            while (sheetCol < MAX_COLS && screenCol + layout.width(sheetCol) <= termCols + 1) {
                 std::string lbl = columnLabel(sheetCol);
-                int width = DEFAULT_COL_WIDTH;
+                int width = layout.width(sheetCol);
+                if ((int)lbl.length() > width) {
+                    lbl = lbl.substr(0, width);
+                }
                 int padding = (width - lbl.length()) / 2;
-                std::cout << std::string(padding, ' ') << lbl;
-                std::cout << std::string(width - padding - lbl.length(), ' ');
+                screen() << std::string(padding, ' ') << lbl;
+                screen() << std::string(width - padding - lbl.length(), ' ');
                 screenCol += width;
                 sheetCol++;
             }
             for (; screenCol <= termCols; screenCol++) {
-                std::cout << ' ';
+                screen() << ' ';
             }
         } else {
             int sheetRow = view.scrollRow + (row - HEADER_ROWS - 1);
+            bool rowHasData = matrix.rowOccupied(sheetRow);
             setReverse(true);
-            std::cout << std::setw(ROW_LABEL_WIDTH) << (sheetRow + 1);
+            screen() << std::setw(ROW_LABEL_WIDTH) << (sheetRow + 1);
             setReverse(false);
 
             int sheetCol = view.scrollCol;
             int screenCol = ROW_LABEL_WIDTH + 1;
-            while (screenCol + DEFAULT_COL_WIDTH <= termCols + 1) {
+            while (sheetCol < MAX_COLS && screenCol + layout.width(sheetCol) <= termCols + 1) {
+                int width = layout.width(sheetCol);
                 bool isActive = (sheetRow == view.cursorRow && sheetCol == view.cursorCol);
                 setReverse(isActive);
 
-                const Cell* cell = matrix.getCellPtr(sheetRow, sheetCol);
+                const Cell* cell = rowHasData ? matrix.getCellPtr(sheetRow, sheetCol) : nullptr;
                 std::string cellDisplay;
                 if (cell && !cell->isEmpty()) {
                     if (cell->type == CellType::Value) {
@@ -235,22 +430,23 @@ void drawSpreadsheetScreen(const SpreadsheetView& view, const Matrix& matrix) {
                     }
                 }
 
-                if (cellDisplay.length() > DEFAULT_COL_WIDTH) {
-                    cellDisplay = cellDisplay.substr(0, DEFAULT_COL_WIDTH);
+                if ((int)cellDisplay.length() > width) {
+                    cellDisplay = cellDisplay.substr(0, width);
                 }
-                std::cout << std::setw(DEFAULT_COL_WIDTH) << cellDisplay;
+                screen() << std::setw(width) << cellDisplay;
 
-                screenCol += DEFAULT_COL_WIDTH;
+                screenCol += width;
                 sheetCol++;
             }
             setReverse(false);
             for (; screenCol <= termCols; screenCol++) {
-                std::cout << ' ';
+                screen() << ' ';
             }
         }
     }
 
     setReverse(false);
     moveCursor(1, 1);
-    std::cout << std::flush;
+    screen() << std::flush;
+    buffer.present();
 }
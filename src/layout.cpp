@@ -0,0 +1,92 @@
+#include "layout.h"
+#include "memory.h"
+#include <algorithm>
+
+ColumnLayout::ColumnLayout(int columns)
+    : widths(columns, DEFAULT_COL_WIDTH), overrides(columns, 0), tree(columns + 1, 0) {
+    rebuild();
+}
+
+void ColumnLayout::rebuild() {
+    int n = columnCount();
+    std::fill(tree.begin(), tree.end(), 0);
+    for (int i = 1; i <= n; i++) {
+        tree[i] += widths[i - 1];
+        int parent = i + (i & -i);
+        if (parent <= n) {
+            tree[parent] += tree[i];
+        }
+    }
+}
+
+void ColumnLayout::setDefaultWidth(int width) {
+    globalWidth = std::min(std::max(width, MIN_COL_WIDTH), MAX_COL_WIDTH);
+    for (int col = 0; col < columnCount(); col++) {
+        if (overrides[col] == 0) {
+            widths[col] = globalWidth;
+        }
+    }
+    rebuild();
+}
+
+void ColumnLayout::setWidth(int col, int width) {
+    if (col < 0 || col >= columnCount()) return;
+
+    overrides[col] = width > 0 ? std::min(std::max(width, MIN_COL_WIDTH), MAX_COL_WIDTH) : 0;
+    int next = overrides[col] != 0 ? overrides[col] : globalWidth;
+    int delta = next - widths[col];
+    widths[col] = next;
+    for (int i = col + 1; i <= columnCount(); i += i & -i) {
+        tree[i] += delta;
+    }
+}
+
+void ColumnLayout::reset() {
+    std::fill(overrides.begin(), overrides.end(), 0);
+    setDefaultWidth(DEFAULT_COL_WIDTH);
+}
+
+long long ColumnLayout::offset(int col) const {
+    long long sum = 0;
+    for (int i = std::min(std::max(col, 0), columnCount()); i > 0; i -= i & -i) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+int ColumnLayout::search(long long x) const {
+    int n = columnCount();
+    int step = 1;
+    while (step * 2 <= n) {
+        step *= 2;
+    }
+
+    int pos = 0;
+    for (; step > 0; step /= 2) {
+        if (pos + step <= n && tree[pos + step] <= x) {
+            pos += step;
+            x -= tree[pos];
+        }
+    }
+    return pos;
+}
+
+int ColumnLayout::columnAt(long long x) const {
+    if (x < 0) return 0;
+    return std::min(search(x), columnCount() - 1);
+}
+
+int ColumnLayout::fittingColumns(int first, int screenWidth) const {
+    int last = search(offset(first) + screenWidth);
+    return std::max(last - first, 1);
+}
+
+int ColumnLayout::scrollToShow(int col, int screenWidth) const {
+    long long target = offset(col + 1) - screenWidth;
+    if (target <= 0) return 0;
+    return std::min(search(target - 1) + 1, col);
+}
+
+size_t ColumnLayout::memoryUsage() const {
+    return vectorBytes(widths) + vectorBytes(overrides) + vectorBytes(tree);
+}
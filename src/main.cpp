@@ -1,7 +1,59 @@
 #include "welcome.h"
 #include "spreadsheet.h"
+#include "server.h"
+#include "display.h"
+#include "terminal.h"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+static int runScript(int argc, char* argv[]) {
+    RenderMode mode = RenderMode::Terminal;
+    int rows = 24;
+    int cols = 80;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+        if (option == "--render") {
+            if (value == "none") mode = RenderMode::None;
+            else if (value == "buffer") mode = RenderMode::Buffer;
+        } else if (option == "--size") {
+            std::sscanf(value.c_str(), "%dx%d", &cols, &rows);
+        }
+    }
+
+    if (!openKeyScript(argv[2])) {
+        std::cerr << "Cannot open key script " << argv[2] << "\n";
+        return 1;
+    }
+    setScreenSize(rows, cols);
+    setRenderMode(mode);
+
+    auto start = std::chrono::steady_clock::now();
+    runSpreadsheet();
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (mode == RenderMode::Buffer) {
+        std::cout << screenSnapshot();
+    }
+    size_t keys = keyScriptKeys();
+    std::cerr << keys << " keys in " << elapsed << " ms";
+    if (keys > 0) {
+        std::cerr << " (" << elapsed * 1000.0 / keys << " us/key)";
+    }
+    std::cerr << "\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 3 && std::string(argv[1]) == "--serve") {
+        return runServer(argv[2], argc >= 4 ? argv[3] : "");
+    }
+    if (argc >= 3 && std::string(argv[1]) == "--script") {
+        return runScript(argc, argv);
+    }
 
-int main() {
     showWelcomeScreen();
     runSpreadsheet();
     return 0;
@@ -1,12 +1,40 @@
 #include "matrix.h"
+#include "parser.h"
+#include "workbook.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+Matrix::Matrix() : cells(createCellMap()), graph(createGraph()) {
+}
+
+Matrix::Matrix(const Matrix* base) : sheetName(base->sheetName), maxIterations(base->maxIterations), iterationTolerance(base->iterationTolerance), base(base), cells(createCellMap()), graph(createGraph()) {
+}
+
+Matrix::CellMap* Matrix::createCellMap() {
+    std::pmr::polymorphic_allocator<CellMap> alloc(&cellArena);
+    CellMap* map = alloc.allocate(1);
+    alloc.construct(map);
+    return map;
+}
+
+Matrix::DependencyGraph* Matrix::createGraph() {
+    std::pmr::polymorphic_allocator<DependencyGraph> alloc(&graphArena);
+    DependencyGraph* result = alloc.allocate(1);
+    alloc.construct(result);
+    return result;
+}
 
 Cell* Matrix::getCellPtr(int row, int col) {
     if (row < 0 || row >= MAX_ROWS || col < 0 || col >= MAX_COLS) {
         return nullptr;
     }
-    auto it = cells.find(cellKey(row, col));
-    if (it == cells.end()) {
+    auto it = cells->find(cellKey(row, col));
+    if (it == cells->end()) {
         return nullptr;
     }
     return &it->second;
@@ -16,9 +44,9 @@ const Cell* Matrix::getCellPtr(int row, int col) const {
     if (row < 0 || row >= MAX_ROWS || col < 0 || col >= MAX_COLS) {
         return nullptr;
     }
-    auto it = cells.find(cellKey(row, col));
-    if (it == cells.end()) {
-        return nullptr;
+    auto it = cells->find(cellKey(row, col));
+    if (it == cells->end()) {
+        return base ? base->getCellPtr(row, col) : nullptr;
     }
     return &it->second;
 }
@@ -27,10 +55,31 @@ void Matrix::setCell(int row, int col, const Cell& cell) {
     if (row < 0 || row >= MAX_ROWS || col < 0 || col >= MAX_COLS) {
         return;
     }
+    int key = cellKey(row, col);
+    detachCell(key);
+    auto it = cells->find(key);
+    bool hadValue = it != cells->end() && it->second.type == CellType::Value;
+    double oldValue = hadValue ? it->second.numericValue : 0.0;
+    if (it != cells->end()) {
+        indexCell(key, it->second, false);
+    }
+    if (!cell.isEmpty()) {
+        indexCell(key, cell, true);
+    }
+    occupancy.set(row, col, !cell.isEmpty());
     if (cell.isEmpty()) {
-        cells.erase(cellKey(row, col));
+        if (it != cells->end()) cells->erase(it);
     } else {
-        cells[cellKey(row, col)] = cell;
+        Cell& stored = (*cells)[key];
+        stored = cell;
+        if (stored.type == CellType::Value && isArrayFormula(stored.text)) {
+            compileArray(stored.text, arrays[key].program);
+        }
+    }
+    updateAggregates(key, hadValue, oldValue, cell.type == CellType::Value, cell.numericValue);
+    cellChanged(key);
+    if (arrays.count(key)) {
+        placeSpill(key);
     }
 }
 
@@ -38,46 +87,136 @@ bool Matrix::hasCell(int row, int col) const {
     if (row < 0 || row >= MAX_ROWS || col < 0 || col >= MAX_COLS) {
         return false;
     }
-    auto it = cells.find(cellKey(row, col));
-    return it != cells.end() && !it->second.isEmpty();
+    auto it = cells->find(cellKey(row, col));
+    return it != cells->end() && !it->second.isEmpty();
 }
 
 void Matrix::clearCell(int row, int col) {
     if (row < 0 || row >= MAX_ROWS || col < 0 || col >= MAX_COLS) {
         return;
     }
-    cells.erase(cellKey(row, col));
+    int key = cellKey(row, col);
+    detachCell(key);
+    auto it = cells->find(key);
+    if (it != cells->end()) {
+        bool hadValue = it->second.type == CellType::Value;
+        double oldValue = it->second.numericValue;
+        indexCell(key, it->second, false);
+        cells->erase(it);
+        occupancy.set(row, col, false);
+        updateAggregates(key, hadValue, oldValue, false, 0.0);
+    }
+    cellChanged(key);
 }
 
-void Matrix::clearAll() {
-    cells.clear();
+void Matrix::cellChanged(int key) {
+    if (transactionDepth > 0) {
+        transactionKeys.insert(key);
+        return;
+    }
+    auto it = cells->find(key);
+    updateDependencies(key, it == cells->end() ? nullptr : &it->second);
+    markDirty(key);
 }
 
-bool Matrix::saveToFile(const std::string& fname) {
-    if (fname.empty()) return false;
+void Matrix::beginTransaction() {
+    transactionDepth++;
+}
 
-    std::ofstream file(fname);
-    if (!file.is_open()) return false;
+void Matrix::commitTransaction(bool recalc) {
+    if (transactionDepth == 0 || --transactionDepth > 0) return;
 
-    for (const auto& pair : cells) {
-        int key = pair.first;
-        const Cell& cell = pair.second;
-        if (cell.isEmpty()) continue;
+    std::vector<int> keys(transactionKeys.begin(), transactionKeys.end());
+    transactionKeys.clear();
+    for (int key : keys) {
+        auto it = cells->find(key);
+        updateDependencies(key, it == cells->end() ? nullptr : &it->second);
+    }
+    for (int key : keys) {
+        markDirty(key);
+    }
+    if (recalc && !manualRecalc) {
+        recalculate();
+    }
+}
 
-        int row = key / MAX_COLS;
-        int col = key % MAX_COLS;
+void Matrix::detachCell(int key) {
+    auto owner = spillAnchors.find(key);
+    if (owner != spillAnchors.end()) {
+        std::vector<int>& spill = arrays[owner->second].spill;
+        spill.erase(std::remove(spill.begin(), spill.end(), key), spill.end());
+        spillAnchors.erase(owner);
+    }
+    if (arrays.count(key)) {
+        releaseSpill(key);
+        arrays.erase(key);
+    }
+}
 
-        char typeChar = 'E';
-        switch (cell.type) {
-            case CellType::Value: typeChar = 'V'; break;
-            case CellType::Label: typeChar = 'L'; break;
-            case CellType::Repeating: typeChar = 'R'; break;
-            default: continue;
+void Matrix::placeSpill(int anchor) {
+    ArrayFormula& array = arrays.at(anchor);
+    int row = anchor / MAX_COLS;
+    int col = anchor % MAX_COLS;
+    for (int r = row; r < row + array.program.rows && r < MAX_ROWS; r++) {
+        for (int c = col; c < col + array.program.cols && c < MAX_COLS; c++) {
+            int key = cellKey(r, c);
+            if (key == anchor || cells->count(key)) continue;
+            Cell spill;
+            spill.type = CellType::Value;
+            setCell(r, c, spill);
+            spillAnchors[key] = anchor;
+            array.spill.push_back(key);
+            cellChanged(key);
         }
+    }
+}
 
-        file << row << "," << col << "," << typeChar << "," << cell.text << "\n";
+void Matrix::releaseSpill(int anchor) {
+    std::vector<int> spill;
+    spill.swap(arrays[anchor].spill);
+    for (int key : spill) {
+        spillAnchors.erase(key);
+        clearCell(key / MAX_COLS, key % MAX_COLS);
     }
+}
+
+void Matrix::clearAll() {
+    cellArena.release();
+    cells = createCellMap();
+    graphArena.release();
+    graph = createGraph();
+    aggregates.clear();
+    arrays.clear();
+    spillAnchors.clear();
+    transactionKeys.clear();
+    manualRecalc = false;
+    maxIterations = DEFAULT_MAX_ITERATIONS;
+    iterationTolerance = DEFAULT_ITERATION_TOLERANCE;
+    columnLayout.reset();
+    savedSettings = SheetImage();
+    savedCells.clear();
+    searchIndex.clear();
+    occupancy.clear();
+    dirty.clear();
+    updateCalcState();
+    if (workbook) {
+        workbook->markSheetDirty(*this);
+    }
+}
 
+bool Matrix::saveToFile(const std::string& fname) {
+    if (fname.empty()) return false;
+
+    std::ofstream file(fname);
+    if (!file.is_open()) return false;
+
+    std::ostringstream out;
+    saveToStream(out);
+    std::string body = out.str();
+    file << body;
+    if (!file) return false;
+
+    markSaved(body);
     filename = fname;
     return true;
 }
@@ -97,8 +236,92 @@ bool Matrix::loadFromFile(const std::string& fname) {
         return false;
     }
 
+    loadFromStream(file);
+
+    filename = fname;
+    return true;
+}
+
+static void writeSettings(std::ostream& out, const SheetImage& settings) {
+    if (settings.manualRecalc) {
+        out << "#GR,M\n";
+    }
+    if (settings.maxIterations != DEFAULT_MAX_ITERATIONS || settings.iterationTolerance != DEFAULT_ITERATION_TOLERANCE) {
+        std::ostringstream tolerance;
+        tolerance << std::setprecision(15) << settings.iterationTolerance;
+        out << "#GI," << settings.maxIterations << "," << tolerance.str() << "\n";
+    }
+    if (settings.defaultWidth != DEFAULT_COL_WIDTH) {
+        out << "#GC," << settings.defaultWidth << "\n";
+    }
+    for (const auto& width : settings.widths) {
+        out << "#CW," << width.first << "," << width.second << "\n";
+    }
+}
+
+static void writeCell(std::ostream& out, int key, const Cell& cell) {
+    if (cell.isEmpty()) return;
+    out << key / MAX_COLS << "," << key % MAX_COLS << "," << cellTypeChar(cell.type) << "," << cell.text << "\n";
+}
+
+static size_t cellHash(const Cell& cell) {
+    std::string line(1, cellTypeChar(cell.type));
+    line += ',';
+    line += cell.text;
+    return std::hash<std::string>{}(line);
+}
+
+void Matrix::saveToStream(std::ostream& out) const {
+    SheetImage settings;
+    settings.manualRecalc = manualRecalc;
+    settings.maxIterations = maxIterations;
+    settings.iterationTolerance = iterationTolerance;
+    settings.defaultWidth = columnLayout.defaultWidth();
+    for (int col = 0; col < columnLayout.columnCount(); col++) {
+        if (columnLayout.hasOverride(col)) settings.widths.push_back({col, columnLayout.width(col)});
+    }
+    writeSettings(out, settings);
+
+    int row = 0;
+    int col = -1;
+    while (occupancy.next(row, col)) {
+        int key = cellKey(row, col);
+        if (spillAnchors.count(key)) continue;
+        writeCell(out, key, cells->at(key));
+    }
+}
+
+bool readSheetImage(std::istream& in, SheetImage& image) {
     std::string line;
-    while (std::getline(file, line)) {
+    while (std::getline(in, line)) {
+        if (line.compare(0, 4, "#GR,") == 0) {
+            image.manualRecalc = line.compare(4, 1, "M") == 0;
+            continue;
+        }
+        if (line.compare(0, 4, "#GI,") == 0) {
+            char* end = nullptr;
+            long limit = std::strtol(line.c_str() + 4, &end, 10);
+            if (*end == ',' && limit >= 1 && limit <= MAX_ITERATIONS) {
+                const char* start = end + 1;
+                double tolerance = std::strtod(start, &end);
+                if (end != start && tolerance >= 0.0) {
+                    image.maxIterations = static_cast<int>(limit);
+                    image.iterationTolerance = tolerance;
+                }
+            }
+            continue;
+        }
+        if (line.compare(0, 4, "#GC,") == 0) {
+            image.defaultWidth = std::atoi(line.c_str() + 4);
+            continue;
+        }
+        if (line.compare(0, 4, "#CW,") == 0) {
+            size_t comma = line.find(',', 4);
+            if (comma != std::string::npos) {
+                image.widths.push_back({std::atoi(line.c_str() + 4), std::atoi(line.c_str() + comma + 1)});
+            }
+            continue;
+        }
         size_t pos1 = line.find(',');
         if (pos1 == std::string::npos) continue;
         size_t pos2 = line.find(',', pos1 + 1);
@@ -106,8 +329,12 @@ bool Matrix::loadFromFile(const std::string& fname) {
         size_t pos3 = line.find(',', pos2 + 1);
         if (pos3 == std::string::npos) continue;
 
-        int row = std::stoi(line.substr(0, pos1));
-        int col = std::stoi(line.substr(pos1 + 1, pos2 - pos1 - 1));
+        char* end = nullptr;
+        long row = std::strtol(line.c_str(), &end, 10);
+        if (end != line.c_str() + pos1) continue;
+        long col = std::strtol(line.c_str() + pos1 + 1, &end, 10);
+        if (end != line.c_str() + pos2) continue;
+        if (row < 0 || row >= MAX_ROWS || col < 0 || col >= MAX_COLS) continue;
         char typeChar = line[pos2 + 1];
         std::string text = line.substr(pos3 + 1);
 
@@ -125,9 +352,919 @@ bool Matrix::loadFromFile(const std::string& fname) {
             default:
                 continue;
         }
-        setCell(row, col, cell);
+        image.cells.push_back({static_cast<int>(row * MAX_COLS + col), std::move(cell)});
     }
+    return !in.bad();
+}
 
-    filename = fname;
+void Matrix::setMergeBase(const SheetImage& image) {
+    savedSettings = SheetImage();
+    savedSettings.manualRecalc = image.manualRecalc;
+    savedSettings.maxIterations = image.maxIterations;
+    savedSettings.iterationTolerance = image.iterationTolerance;
+    savedSettings.defaultWidth = image.defaultWidth;
+    savedSettings.widths = image.widths;
+    savedCells.clear();
+    savedCells.reserve(image.cells.size());
+    for (const auto& entry : image.cells) {
+        if (!entry.second.isEmpty()) savedCells[entry.first] = cellHash(entry.second);
+    }
+}
+
+void Matrix::markSaved(const std::string& body) {
+    std::istringstream in(body);
+    SheetImage image;
+    readSheetImage(in, image);
+    setMergeBase(image);
+}
+
+std::string Matrix::savedBase() const {
+    std::ostringstream out;
+    writeSettings(out, savedSettings);
+    for (const auto& entry : savedCells) {
+        out << "#SH," << entry.first << "," << entry.second << "\n";
+    }
+    return out.str();
+}
+
+void Matrix::restoreSavedBase(const std::string& base) {
+    std::istringstream in(base);
+    SheetImage image;
+    readSheetImage(in, image);
+    setMergeBase(image);
+
+    std::istringstream lines(base);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 4, "#SH,") != 0) continue;
+        char* end = nullptr;
+        long key = std::strtol(line.c_str() + 4, &end, 10);
+        if (*end != ',' || key < 0 || key >= MAX_ROWS * MAX_COLS) continue;
+        savedCells[static_cast<int>(key)] = static_cast<size_t>(std::strtoull(end + 1, nullptr, 10));
+    }
+}
+
+void Matrix::loadFromStream(std::istream& in) {
+    SheetImage image;
+    readSheetImage(in, image);
+    mergeImage(image);
+}
+
+static std::vector<int> imageWidths(const SheetImage& image) {
+    std::vector<int> widths(MAX_COLS, 0);
+    for (const auto& width : image.widths) {
+        if (width.first >= 0 && width.first < MAX_COLS) widths[width.first] = width.second;
+    }
+    return widths;
+}
+
+static std::unordered_map<int, const Cell*> imageCells(const SheetImage& image) {
+    std::unordered_map<int, const Cell*> result;
+    result.reserve(image.cells.size());
+    for (const auto& entry : image.cells) {
+        result[entry.first] = &entry.second;
+    }
+    return result;
+}
+
+static bool matchesBase(const std::unordered_map<int, size_t>& base, int key, const Cell* cell) {
+    auto it = base.find(key);
+    if (!cell || cell->isEmpty()) return it == base.end();
+    return it != base.end() && it->second == cellHash(*cell);
+}
+
+static bool sameCell(const Cell* a, const Cell* b) {
+    if (!a || a->isEmpty()) return !b || b->isEmpty();
+    return b && a->type == b->type && a->text == b->text;
+}
+
+size_t Matrix::mergeImage(const SheetImage& image) {
+    beginTransaction();
+    if (image.manualRecalc != savedSettings.manualRecalc) {
+        manualRecalc = image.manualRecalc;
+    }
+    if (image.maxIterations != savedSettings.maxIterations || image.iterationTolerance != savedSettings.iterationTolerance) {
+        setIteration(image.maxIterations, image.iterationTolerance);
+    }
+    if (image.defaultWidth != savedSettings.defaultWidth && columnLayout.defaultWidth() != image.defaultWidth) {
+        columnLayout.setDefaultWidth(image.defaultWidth);
+    }
+    std::vector<int> widths = imageWidths(image);
+    std::vector<int> baseWidths = imageWidths(savedSettings);
+    for (int col = 0; col < MAX_COLS; col++) {
+        if (widths[col] == baseWidths[col]) continue;
+        int local = columnLayout.hasOverride(col) ? columnLayout.width(col) : 0;
+        if (local != widths[col]) columnLayout.setWidth(col, widths[col]);
+    }
+
+    std::unordered_map<int, const Cell*> remote = imageCells(image);
+    std::vector<int> keys;
+    keys.reserve(remote.size() + savedCells.size());
+    for (const auto& entry : image.cells) keys.push_back(entry.first);
+    for (const auto& entry : savedCells) {
+        if (!remote.count(entry.first)) keys.push_back(entry.first);
+    }
+
+    std::vector<int> merged;
+    for (int key : keys) {
+        auto theirs = remote.find(key);
+        const Cell* cell = theirs == remote.end() ? nullptr : theirs->second;
+        if (matchesBase(savedCells, key, cell)) continue;
+        auto it = cells->find(key);
+        const Cell* local = it == cells->end() || spillAnchors.count(key) ? nullptr : &it->second;
+        if (sameCell(local, cell)) continue;
+        if (cell) {
+            setCell(key / MAX_COLS, key % MAX_COLS, *cell);
+        } else {
+            clearCell(key / MAX_COLS, key % MAX_COLS);
+        }
+        merged.push_back(key);
+    }
+    setMergeBase(image);
+
+    commitTransaction(false);
+    if (manualRecalc) {
+        std::unordered_set<int> affected = dependentClosure(merged);
+        affected.insert(merged.begin(), merged.end());
+        for (int key : affected) {
+            evaluate(key);
+        }
+        updateCalcState();
+    }
+    return merged.size();
+}
+
+const Matrix* Matrix::referencedSheet(const RangeRef& ref) const {
+    if (ref.sheet.empty() || ref.sheet == sheetName) return this;
+    if (base) {
+        auto source = overlaySheets.find(ref.sheet);
+        return source == overlaySheets.end() ? nullptr : source->second;
+    }
+    if (!workbook) return nullptr;
+
+    Matrix* other = workbook->sheet(ref.sheet);
+    if (!other) return nullptr;
+    if (other != this) {
+        other->recalculateWindow(ref.row1, ref.col1, ref.row2 - ref.row1 + 1, ref.col2 - ref.col1 + 1);
+    }
+    return other;
+}
+
+void Matrix::markExternalDirty(const std::string& sheet, int key) {
+    auto ext = graph->externalDependents.find(std::pmr::string(sheet));
+    if (ext == graph->externalDependents.end()) return;
+    auto dep = ext->second.find(key);
+    if (dep == ext->second.end()) return;
+    std::vector<int> keys(dep->second.begin(), dep->second.end());
+    for (int d : keys) {
+        markDirty(d);
+    }
+}
+
+void Matrix::markExternalSheetDirty(const std::string& sheet) {
+    auto ext = graph->externalDependents.find(std::pmr::string(sheet));
+    if (ext == graph->externalDependents.end()) return;
+    std::vector<int> keys;
+    for (const auto& dep : ext->second) {
+        keys.insert(keys.end(), dep.second.begin(), dep.second.end());
+    }
+    for (int d : keys) {
+        markDirty(d);
+    }
+}
+
+void Matrix::updateDependencies(int key, const Cell* cell) {
+    auto it = graph->precedents.find(key);
+    if (it != graph->precedents.end()) {
+        for (int p : it->second) {
+            auto dep = graph->dependents.find(p);
+            if (dep == graph->dependents.end()) continue;
+            dep->second.erase(key);
+            if (dep->second.empty()) {
+                graph->dependents.erase(dep);
+            }
+        }
+        graph->precedents.erase(it);
+    }
+
+    auto ext = graph->externalPrecedents.find(key);
+    if (ext != graph->externalPrecedents.end()) {
+        for (const auto& p : ext->second) {
+            auto sheetDeps = graph->externalDependents.find(p.first);
+            if (sheetDeps == graph->externalDependents.end()) continue;
+            auto dep = sheetDeps->second.find(p.second);
+            if (dep == sheetDeps->second.end()) continue;
+            dep->second.erase(key);
+            if (dep->second.empty()) {
+                sheetDeps->second.erase(dep);
+            }
+        }
+        graph->externalPrecedents.erase(ext);
+    }
+
+    auto ranges = graph->formulaRanges.find(key);
+    if (ranges != graph->formulaRanges.end()) {
+        for (long long range : ranges->second) {
+            auto dep = graph->rangeDependents.find(range);
+            if (dep != graph->rangeDependents.end()) {
+                dep->second.erase(key);
+                if (dep->second.empty()) {
+                    graph->rangeDependents.erase(dep);
+                }
+            }
+            releaseAggregate(range);
+        }
+        graph->formulaRanges.erase(ranges);
+    }
+
+    if (!cell || cell->type != CellType::Value) return;
+
+    auto owner = spillAnchors.find(key);
+    if (owner != spillAnchors.end()) {
+        graph->precedents[key].push_back(owner->second);
+        graph->dependents[owner->second].insert(key);
+        return;
+    }
+
+    std::vector<RangeRef> refs;
+    auto array = arrays.find(key);
+    if (array != arrays.end()) {
+        refs = array->second.program.refs;
+    } else {
+        collectReferences(cell->text, refs);
+    }
+    if (refs.empty()) return;
+
+    std::vector<int> list;
+    for (const RangeRef& ref : refs) {
+        bool local = ref.sheet.empty() || ref.sheet == sheetName;
+        if (local && (ref.row1 != ref.row2 || ref.col1 != ref.col2)) {
+            long long range = rangeKey(ref);
+            auto& spans = graph->formulaRanges[key];
+            if (std::find(spans.begin(), spans.end(), range) == spans.end()) {
+                spans.push_back(range);
+                graph->rangeDependents[range].insert(key);
+                retainAggregate(range, ref);
+            }
+            continue;
+        }
+        for (int r = ref.row1; r <= ref.row2; r++) {
+            for (int c = ref.col1; c <= ref.col2; c++) {
+                if (local) {
+                    list.push_back(cellKey(r, c));
+                } else {
+                    graph->externalPrecedents[key].emplace_back(ref.sheet, cellKey(r, c));
+                    graph->externalDependents[std::pmr::string(ref.sheet)][cellKey(r, c)].insert(key);
+                }
+            }
+        }
+    }
+    if (list.empty()) return;
+
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+    for (int p : list) {
+        graph->dependents[p].insert(key);
+    }
+    graph->precedents[key].assign(list.begin(), list.end());
+}
+
+void Matrix::markDirty(int key) {
+    std::vector<int> stack{key};
+    while (!stack.empty()) {
+        int k = stack.back();
+        stack.pop_back();
+        if (!dirty.insert(k).second) continue;
+        if (workbook) {
+            workbook->markReferencesDirty(*this, k);
+        }
+        appendDependents(k, stack);
+    }
+}
+
+void Matrix::appendDependents(int key, std::vector<int>& out) const {
+    auto dep = graph->dependents.find(key);
+    if (dep != graph->dependents.end()) {
+        out.insert(out.end(), dep->second.begin(), dep->second.end());
+    }
+    auto column = graph->columnRanges.find(key % MAX_COLS);
+    if (column == graph->columnRanges.end()) return;
+    for (long long range : column->second) {
+        if (!rangeContains(range, key)) continue;
+        auto watchers = graph->rangeDependents.find(range);
+        if (watchers != graph->rangeDependents.end()) {
+            out.insert(out.end(), watchers->second.begin(), watchers->second.end());
+        }
+    }
+}
+
+void Matrix::dirtyInRange(long long range, std::vector<int>& out) const {
+    int first = static_cast<int>(range / (MAX_ROWS * MAX_COLS));
+    int last = static_cast<int>(range % (MAX_ROWS * MAX_COLS));
+    size_t area = static_cast<size_t>(last / MAX_COLS - first / MAX_COLS + 1) * static_cast<size_t>(last % MAX_COLS - first % MAX_COLS + 1);
+    if (dirty.size() < area) {
+        for (int key : dirty) {
+            if (rangeContains(range, key)) out.push_back(key);
+        }
+        return;
+    }
+    for (int r = first / MAX_COLS; r <= last / MAX_COLS; r++) {
+        for (int c = first % MAX_COLS; c <= last % MAX_COLS; c++) {
+            if (dirty.count(cellKey(r, c))) out.push_back(cellKey(r, c));
+        }
+    }
+}
+
+void Matrix::evaluate(int key) {
+    if (!dirty.count(key) || evaluating.count(key)) return;
+
+    std::unordered_map<int, int> index;
+    std::unordered_map<int, int> lowlink;
+    std::vector<int> sccStack;
+    std::unordered_set<int> onSccStack;
+    std::vector<std::pair<int, size_t>> callStack;
+    std::unordered_map<int, std::vector<int>> members;
+    int counter = 0;
+
+    auto visit = [&](int k) {
+        index[k] = lowlink[k] = counter++;
+        sccStack.push_back(k);
+        onSccStack.insert(k);
+        evaluating.insert(k);
+        auto spans = graph->formulaRanges.find(k);
+        if (spans != graph->formulaRanges.end()) {
+            std::vector<int>& list = members[k];
+            for (long long range : spans->second) {
+                dirtyInRange(range, list);
+            }
+        }
+        callStack.push_back({k, 0});
+    };
+
+    visit(key);
+    while (!callStack.empty()) {
+        int k = callStack.back().first;
+        size_t pos = callStack.back().second;
+        auto pre = graph->precedents.find(k);
+        size_t direct = pre != graph->precedents.end() ? pre->second.size() : 0;
+        const std::vector<int>* extra = nullptr;
+        if (pos >= direct) {
+            auto found = members.find(k);
+            if (found != members.end()) extra = &found->second;
+        }
+        if (pos < direct || (extra && pos - direct < extra->size())) {
+            int p = pos < direct ? pre->second[pos] : (*extra)[pos - direct];
+            callStack.back().second++;
+            if (!dirty.count(p)) continue;
+            auto seen = index.find(p);
+            if (seen == index.end()) {
+                if (!evaluating.count(p)) {
+                    visit(p);
+                }
+            } else if (onSccStack.count(p)) {
+                lowlink[k] = std::min(lowlink[k], seen->second);
+            }
+            continue;
+        }
+
+        callStack.pop_back();
+        if (!callStack.empty()) {
+            int parent = callStack.back().first;
+            lowlink[parent] = std::min(lowlink[parent], lowlink[k]);
+        }
+        if (lowlink[k] != index[k]) continue;
+
+        std::vector<int> component;
+        int member;
+        do {
+            member = sccStack.back();
+            sccStack.pop_back();
+            onSccStack.erase(member);
+            component.push_back(member);
+        } while (member != k);
+        solveComponent(component);
+    }
+}
+
+bool Matrix::evaluateCell(int key, double& delta) {
+    auto it = cells->find(key);
+    if (it == cells->end() || it->second.type != CellType::Value) return false;
+
+    double previous = it->second.numericValue;
+    auto array = arrays.find(key);
+    auto owner = spillAnchors.find(key);
+    if (array != arrays.end()) {
+        evaluateArray(array->second.program, *this, array->second.values);
+        it->second.numericValue = array->second.values[0];
+    } else if (owner != spillAnchors.end()) {
+        const ArrayFormula& source = arrays.at(owner->second);
+        size_t offset = static_cast<size_t>((key / MAX_COLS - owner->second / MAX_COLS) * source.program.cols + key % MAX_COLS - owner->second % MAX_COLS);
+        it->second.numericValue = offset < source.values.size() ? source.values[offset] : 0.0;
+    } else {
+        it->second.numericValue = parseValue(it->second.text, *this);
+    }
+    delta = std::fabs(it->second.numericValue - previous);
+    if (it->second.numericValue != previous) {
+        searchIndex.removeValue(key, previous);
+        searchIndex.addValue(key, it->second.numericValue);
+    }
+    updateAggregates(key, true, previous, true, it->second.numericValue);
+    return true;
+}
+
+void Matrix::indexCell(int key, const Cell& cell, bool add) {
+    if (cell.type == CellType::Label) {
+        if (add) {
+            searchIndex.addLabel(key, cell.text);
+        } else {
+            searchIndex.removeLabel(key);
+        }
+    } else if (cell.type == CellType::Value) {
+        if (add) {
+            searchIndex.addValue(key, cell.numericValue);
+        } else {
+            searchIndex.removeValue(key, cell.numericValue);
+        }
+    }
+}
+
+bool Matrix::findNext(const std::string& query, int& row, int& col) const {
+    int key;
+    if (!searchIndex.findNext(query, cellKey(row, col), calcOrder() == CalcMode::Column, key)) {
+        return false;
+    }
+    row = key / MAX_COLS;
+    col = key % MAX_COLS;
+    return true;
+}
+
+void Matrix::retainAggregate(long long range, const RangeRef& ref) {
+    AggregateEntry& entry = aggregates[range];
+    if (entry.refs++ > 0) return;
+
+    entry.ref = ref;
+    entry.state.stale = true;
+    for (int c = ref.col1; c <= ref.col2; c++) {
+        graph->columnRanges[c].push_back(range);
+    }
+}
+
+void Matrix::releaseAggregate(long long range) {
+    auto entry = aggregates.find(range);
+    if (entry == aggregates.end() || --entry->second.refs > 0) return;
+
+    const RangeRef& ref = entry->second.ref;
+    for (int c = ref.col1; c <= ref.col2; c++) {
+        auto column = graph->columnRanges.find(c);
+        if (column == graph->columnRanges.end()) continue;
+        auto& list = column->second;
+        list.erase(std::remove(list.begin(), list.end(), range), list.end());
+        if (list.empty()) {
+            graph->columnRanges.erase(column);
+        }
+    }
+    aggregates.erase(entry);
+}
+
+void Matrix::updateAggregates(int key, bool hadValue, double oldValue, bool hasValue, double newValue) {
+    if (hadValue == hasValue && (!hasValue || oldValue == newValue)) return;
+    auto column = graph->columnRanges.find(key % MAX_COLS);
+    if (column == graph->columnRanges.end()) return;
+
+    bool finite = (!hadValue || std::isfinite(oldValue)) && (!hasValue || std::isfinite(newValue));
+    for (long long range : column->second) {
+        if (!rangeContains(range, key)) continue;
+        AggregateState& state = aggregates[range].state;
+        if (state.stale) continue;
+        if (!finite || ++state.updates >= state.cells) {
+            state.stale = true;
+            continue;
+        }
+        if (hadValue) {
+            state.sum -= oldValue;
+            state.count--;
+            auto v = state.values.find(oldValue);
+            if (v != state.values.end() && --v->second == 0) {
+                state.values.erase(v);
+            }
+        }
+        if (hasValue) {
+            state.sum += newValue;
+            state.count++;
+            state.values[newValue]++;
+        }
+    }
+}
+
+const AggregateState* Matrix::cachedAggregate(const RangeRef& ref) const {
+    auto entry = aggregates.find(rangeKey(ref));
+    return entry == aggregates.end() || entry->second.state.stale ? nullptr : &entry->second.state;
+}
+
+const AggregateState* Matrix::sourceAggregate(const Matrix* source, const RangeRef& ref) const {
+    if (!base) return source->rangeAggregate(ref);
+    return source == this ? nullptr : source->cachedAggregate(ref);
+}
+
+const AggregateState* Matrix::rangeAggregate(const RangeRef& ref) const {
+    if (base) return nullptr;
+    auto entry = aggregates.find(rangeKey(ref));
+    if (entry == aggregates.end()) return nullptr;
+
+    AggregateState& state = entry->second.state;
+    if (state.stale) {
+        state = AggregateState();
+        state.cells = static_cast<size_t>(ref.row2 - ref.row1 + 1) * static_cast<size_t>(ref.col2 - ref.col1 + 1);
+        for (int r = ref.row1; r <= ref.row2; r++) {
+            for (int c = ref.col1; c <= ref.col2; c++) {
+                const Cell* cell = getCellPtr(r, c);
+                if (!cell || cell->type != CellType::Value) continue;
+                if (!std::isfinite(cell->numericValue)) {
+                    state.stale = true;
+                    return nullptr;
+                }
+                state.sum += cell->numericValue;
+                state.count++;
+                state.values[cell->numericValue]++;
+            }
+        }
+        state.stale = false;
+    }
+    return &state;
+}
+
+void Matrix::solveComponent(std::vector<int>& component) {
+    bool cyclic = component.size() > 1;
+    if (!cyclic) {
+        int key = component[0];
+        auto pre = graph->precedents.find(key);
+        cyclic = pre != graph->precedents.end() && std::binary_search(pre->second.begin(), pre->second.end(), key);
+        auto spans = graph->formulaRanges.find(key);
+        if (!cyclic && spans != graph->formulaRanges.end()) {
+            cyclic = std::any_of(spans->second.begin(), spans->second.end(), [key](long long range) { return rangeContains(range, key); });
+        }
+    }
+
+    double delta = 0.0;
+    if (!cyclic) {
+        evaluateCell(component[0], delta);
+    } else {
+        sortByCalcOrder(component);
+        for (int iteration = 0; iteration < maxIterations; iteration++) {
+            double maxDelta = 0.0;
+            for (int k : component) {
+                if (evaluateCell(k, delta)) {
+                    maxDelta = std::max(maxDelta, delta);
+                }
+            }
+            if (maxDelta <= iterationTolerance) break;
+        }
+    }
+
+    for (int k : component) {
+        dirty.erase(k);
+        evaluating.erase(k);
+    }
+}
+
+void Matrix::sortByCalcOrder(std::vector<int>& keys) const {
+    if (calcOrder() == CalcMode::Row) {
+        std::sort(keys.begin(), keys.end());
+    } else {
+        std::sort(keys.begin(), keys.end(), [](int a, int b) {
+            int colA = a % MAX_COLS;
+            int colB = b % MAX_COLS;
+            return colA != colB ? colA < colB : a < b;
+        });
+    }
+}
+
+void Matrix::updateCalcState() {
+    if (dirty.empty()) {
+        if (calcMode == CalcMode::Recalculating) {
+            calcMode = recalcOrder;
+        }
+        recalcQueue.clear();
+        recalcQueuePos = 0;
+        recalcTotal = 0;
+        return;
+    }
+    if (calcMode != CalcMode::Recalculating) {
+        recalcOrder = calcMode;
+        calcMode = CalcMode::Recalculating;
+    }
+    recalcTotal = std::max(recalcTotal, dirty.size());
+}
+
+void Matrix::setIteration(int limit, double tolerance) {
+    if (limit == maxIterations && tolerance == iterationTolerance) return;
+
+    maxIterations = limit;
+    iterationTolerance = tolerance;
+    std::vector<int> formulas;
+    formulas.reserve(graph->precedents.size() + graph->formulaRanges.size());
+    for (const auto& pair : graph->precedents) {
+        formulas.push_back(pair.first);
+    }
+    for (const auto& pair : graph->formulaRanges) {
+        formulas.push_back(pair.first);
+    }
+    for (int key : formulas) {
+        markDirty(key);
+    }
+}
+
+void Matrix::recalculate() {
+    while (!dirty.empty()) {
+        evaluate(*dirty.begin());
+    }
+    updateCalcState();
+}
+
+void Matrix::recalculateWindow(int row, int col, int rows, int cols) {
+    if (dirty.empty() || manualRecalc) return;
+
+    int lastRow = std::min(row + rows, MAX_ROWS);
+    int lastCol = std::min(col + cols, MAX_COLS);
+    for (int r = std::max(row, 0); r < lastRow; r++) {
+        for (int c = std::max(col, 0); c < lastCol; c++) {
+            evaluate(cellKey(r, c));
+        }
+    }
+    updateCalcState();
+}
+
+bool Matrix::recalcStep(size_t budget) {
+    if (manualRecalc) return false;
+    updateCalcState();
+    if (dirty.empty()) return false;
+
+    if (recalcQueuePos >= recalcQueue.size()) {
+        recalcQueue.assign(dirty.begin(), dirty.end());
+        sortByCalcOrder(recalcQueue);
+        recalcQueuePos = 0;
+    }
+
+    for (size_t done = 0; done < budget && recalcQueuePos < recalcQueue.size(); done++) {
+        evaluate(recalcQueue[recalcQueuePos++]);
+    }
+
+    updateCalcState();
+    return needsRecalc();
+}
+
+int Matrix::recalcProgress() const {
+    if (recalcTotal == 0) return 100;
+    return static_cast<int>((recalcTotal - std::min(dirty.size(), recalcTotal)) * 100 / recalcTotal);
+}
+
+MemoryUsage Matrix::memoryUsage() const {
+    MemoryUsage usage;
+    usage.cellCount = cells->size();
+
+    for (const auto& pair : *cells) {
+        usage.text += stringBytes(pair.second.text) + stringBytes(pair.second.format);
+    }
+    usage.text = std::min(usage.text, cellUsage.allocated());
+    usage.cells = sizeof(Matrix) + cellUsage.allocated() - usage.text;
+
+    usage.formulas = graphUsage.allocated() + hashBytes(arrays) + hashBytes(spillAnchors);
+    for (const auto& pair : arrays) {
+        const ArrayFormula& array = pair.second;
+        usage.formulas += vectorBytes(array.program.ops) + vectorBytes(array.program.refs) + vectorBytes(array.values) + vectorBytes(array.spill);
+    }
+
+    usage.indexes = searchIndex.memoryUsage() + occupancy.memoryUsage() + columnLayout.memoryUsage();
+
+    usage.caches = hashBytes(aggregates) + hashBytes(dirty) + hashBytes(evaluating) + vectorBytes(recalcQueue) + hashBytes(transactionKeys);
+    for (const auto& pair : aggregates) usage.caches += treeBytes(pair.second.state.values);
+    usage.caches += vectorBytes(savedSettings.widths) + hashBytes(savedCells);
+    return usage;
+}
+
+std::vector<std::pair<int, int>> Matrix::pendingCells() const {
+    std::vector<std::pair<int, int>> result;
+    result.reserve(dirty.size());
+    for (int key : dirty) {
+        result.push_back({key / MAX_COLS, key % MAX_COLS});
+    }
+    return result;
+}
+
+bool Matrix::dataTable(const RangeRef& table, const RangeRef& input) {
+    if (!input.sheet.empty() && input.sheet != sheetName) return false;
+    return runDataTable(table, -1, cellKey(input.row1, input.col1));
+}
+
+bool Matrix::dataTable(const RangeRef& table, const RangeRef& rowInput, const RangeRef& columnInput) {
+    if (!rowInput.sheet.empty() && rowInput.sheet != sheetName) return false;
+    if (!columnInput.sheet.empty() && columnInput.sheet != sheetName) return false;
+    return runDataTable(table, cellKey(rowInput.row1, rowInput.col1), cellKey(columnInput.row1, columnInput.col1));
+}
+
+std::unordered_set<int> Matrix::dependentClosure(const std::vector<int>& keys) const {
+    std::unordered_set<int> closure;
+    std::vector<int> stack(keys);
+    std::vector<int> next;
+    while (!stack.empty()) {
+        int key = stack.back();
+        stack.pop_back();
+        next.clear();
+        appendDependents(key, next);
+        for (int d : next) {
+            if (closure.insert(d).second) stack.push_back(d);
+        }
+    }
+    return closure;
+}
+
+std::vector<int> Matrix::dependentOrder(const std::vector<int>& inputs, size_t& acyclic) const {
+    std::unordered_set<int> closure = dependentClosure(inputs);
+    for (int key : inputs) {
+        closure.erase(key);
+    }
+
+    std::unordered_map<int, int> waiting;
+    for (int key : closure) {
+        int count = 0;
+        auto pre = graph->precedents.find(key);
+        if (pre != graph->precedents.end()) {
+            for (int p : pre->second) {
+                if (closure.count(p)) count++;
+            }
+        }
+        auto spans = graph->formulaRanges.find(key);
+        if (spans != graph->formulaRanges.end()) {
+            for (long long range : spans->second) {
+                for (int p : closure) {
+                    if (rangeContains(range, p)) count++;
+                }
+            }
+        }
+        waiting[key] = count;
+    }
+
+    std::vector<int> order;
+    for (const auto& entry : waiting) {
+        if (entry.second == 0) order.push_back(entry.first);
+    }
+    sortByCalcOrder(order);
+    std::vector<int> next;
+    for (size_t i = 0; i < order.size(); i++) {
+        next.clear();
+        appendDependents(order[i], next);
+        for (int d : next) {
+            auto entry = waiting.find(d);
+            if (entry != waiting.end() && --entry->second == 0) order.push_back(d);
+        }
+    }
+    acyclic = order.size();
+
+    std::vector<int> cyclic;
+    for (const auto& entry : waiting) {
+        if (entry.second > 0) cyclic.push_back(entry.first);
+    }
+    sortByCalcOrder(cyclic);
+    order.insert(order.end(), cyclic.begin(), cyclic.end());
+    return order;
+}
+
+void Matrix::prepareReferences(int key, std::unordered_map<std::string, const Matrix*>& sheets) {
+    const Cell* cell = getCellPtr(key / MAX_COLS, key % MAX_COLS);
+    if (!cell || cell->type != CellType::Value) return;
+
+    std::vector<RangeRef> refs;
+    auto array = arrays.find(key);
+    if (array != arrays.end()) {
+        refs = array->second.program.refs;
+    } else {
+        collectReferences(cell->text, refs);
+    }
+    for (const RangeRef& ref : refs) {
+        if (ref.sheet.empty() || ref.sheet == sheetName || !workbook) continue;
+        Matrix* other = workbook->sheet(ref.sheet);
+        if (!other) continue;
+        if (other != this) {
+            other->recalculate();
+            other->rangeAggregate(ref);
+        }
+        sheets[ref.sheet] = other;
+    }
+}
+
+void Matrix::overrideValue(int key, double value) {
+    Cell& cell = (*cells)[key];
+    cell.type = CellType::Value;
+    cell.numericValue = value;
+}
+
+double Matrix::overlayValue(int key) {
+    const Cell* cell = base->getCellPtr(key / MAX_COLS, key % MAX_COLS);
+    if (!cell || cell->type != CellType::Value) return 0.0;
+
+    auto array = base->arrays.find(key);
+    if (array != base->arrays.end()) {
+        std::vector<double>& values = arrays[key].values;
+        evaluateArray(array->second.program, *this, values);
+        return values.empty() ? 0.0 : values[0];
+    }
+    auto owner = base->spillAnchors.find(key);
+    if (owner != base->spillAnchors.end()) {
+        auto local = arrays.find(owner->second);
+        const std::vector<double>& values = local != arrays.end() ? local->second.values : base->arrays.at(owner->second).values;
+        int cols = base->arrays.at(owner->second).program.cols;
+        size_t offset = static_cast<size_t>((key / MAX_COLS - owner->second / MAX_COLS) * cols + key % MAX_COLS - owner->second % MAX_COLS);
+        return offset < values.size() ? values[offset] : 0.0;
+    }
+    return parseValue(cell->text, *this);
+}
+
+void Matrix::evaluateOverlay(const std::vector<int>& order, size_t acyclic) {
+    for (int key : order) {
+        overrideValue(key, overlayValue(key));
+    }
+    for (int iteration = 1; iteration < maxIterations && acyclic < order.size(); iteration++) {
+        double maxDelta = 0.0;
+        for (size_t i = acyclic; i < order.size(); i++) {
+            Cell& cell = cells->at(order[i]);
+            double value = overlayValue(order[i]);
+            maxDelta = std::max(maxDelta, std::fabs(value - cell.numericValue));
+            cell.numericValue = value;
+        }
+        if (maxDelta <= iterationTolerance) break;
+    }
+}
+
+bool Matrix::runDataTable(const RangeRef& table, int rowInput, int columnInput) {
+    if (base || (!table.sheet.empty() && table.sheet != sheetName)) return false;
+    if (table.row2 <= table.row1 || table.col2 <= table.col1) return false;
+
+    recalculate();
+
+    std::vector<int> inputs;
+    if (rowInput >= 0) inputs.push_back(rowInput);
+    inputs.push_back(columnInput);
+    size_t acyclic = 0;
+    std::vector<int> order = dependentOrder(inputs, acyclic);
+
+    struct Job {
+        double rowValue;
+        double columnValue;
+        int output;
+        int target;
+    };
+    auto valueAt = [this](int row, int col) {
+        const Cell* cell = getCellPtr(row, col);
+        return cell && cell->type == CellType::Value ? cell->numericValue : 0.0;
+    };
+    std::vector<Job> jobs;
+    for (int r = table.row1 + 1; r <= table.row2; r++) {
+        for (int c = table.col1 + 1; c <= table.col2; c++) {
+            if (rowInput < 0) {
+                jobs.push_back({0.0, valueAt(r, table.col1), cellKey(table.row1, c), cellKey(r, c)});
+            } else {
+                jobs.push_back({valueAt(table.row1, c), valueAt(r, table.col1), cellKey(table.row1, table.col1), cellKey(r, c)});
+            }
+        }
+    }
+
+    std::unordered_map<std::string, const Matrix*> sheets;
+    for (int key : order) {
+        prepareReferences(key, sheets);
+    }
+    for (const Job& job : jobs) {
+        prepareReferences(job.output, sheets);
+    }
+
+    std::vector<double> results(jobs.size(), 0.0);
+    size_t workerCount = tableWorkers > 0 ? tableWorkers : std::thread::hardware_concurrency();
+    size_t threads = std::max<size_t>(1, std::min<size_t>(workerCount, jobs.size()));
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            Matrix clone(this);
+            clone.overlaySheets = sheets;
+            for (size_t j = t; j < jobs.size(); j += threads) {
+                if (rowInput >= 0) clone.overrideValue(rowInput, jobs[j].rowValue);
+                clone.overrideValue(columnInput, jobs[j].columnValue);
+                clone.evaluateOverlay(order, acyclic);
+                const Cell* output = clone.getCellPtr(jobs[j].output / MAX_COLS, jobs[j].output % MAX_COLS);
+                results[j] = output && output->type == CellType::Value ? output->numericValue : 0.0;
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    beginTransaction();
+    for (size_t j = 0; j < jobs.size(); j++) {
+        std::ostringstream text;
+        text << std::setprecision(15) << results[j];
+        Cell cell;
+        cell.setValue(text.str(), results[j]);
+        setCell(jobs[j].target / MAX_COLS, jobs[j].target % MAX_COLS, cell);
+    }
+    commitTransaction();
     return true;
 }
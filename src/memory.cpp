@@ -0,0 +1,85 @@
+#include "memory.h"
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+MemoryUsage& MemoryUsage::operator+=(const MemoryUsage& other) {
+    cells += other.cells;
+    text += other.text;
+    formulas += other.formulas;
+    indexes += other.indexes;
+    caches += other.caches;
+    cellCount += other.cellCount;
+    return *this;
+}
+
+void* CountingResource::do_allocate(size_t bytes, size_t alignment) {
+    void* p = upstream->allocate(bytes, alignment);
+    current += bytes;
+    if (current > highest) highest = current;
+    return p;
+}
+
+void CountingResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    upstream->deallocate(p, bytes, alignment);
+    current -= bytes;
+}
+
+bool CountingResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+std::string formatBytes(size_t bytes) {
+    const char* units[] = {"B", "K", "M", "G", "T"};
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 4) {
+        value /= 1024.0;
+        unit++;
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), unit == 0 ? "%.0f%s" : "%.1f%s", value, units[unit]);
+    return text;
+}
+
+size_t residentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.WorkingSetSize;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS) return 0;
+    return static_cast<size_t>(info.resident_size);
+#else
+    FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+    unsigned long pages = 0;
+    unsigned long resident = 0;
+    int fields = std::fscanf(statm, "%lu %lu", &pages, &resident);
+    std::fclose(statm);
+    if (fields != 2) return 0;
+    return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+size_t heapAllocatedBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
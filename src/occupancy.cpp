@@ -0,0 +1,158 @@
+#include "occupancy.h"
+#include "memory.h"
+#include <algorithm>
+
+static int lowestBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static int highestBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(word);
+#else
+    int bit = 63;
+    while (!(word & (uint64_t(1) << 63))) {
+        word <<= 1;
+        bit--;
+    }
+    return bit;
+#endif
+}
+
+static void setBit(uint64_t* words, int index, bool value) {
+    uint64_t mask = uint64_t(1) << (index % 64);
+    if (value) {
+        words[index / 64] |= mask;
+    } else {
+        words[index / 64] &= ~mask;
+    }
+}
+
+static bool testBit(const uint64_t* words, int index) {
+    return (words[index / 64] >> (index % 64)) & 1;
+}
+
+static int findBit(const uint64_t* words, int count, int from, int step, bool value) {
+    if (from < 0 || from >= count) return -1;
+
+    int word = from / 64;
+    int lastWord = (count - 1) / 64;
+    if (step > 0) {
+        uint64_t bits = (value ? words[word] : ~words[word]) & (~uint64_t(0) << (from % 64));
+        while (true) {
+            if (bits) {
+                int index = word * 64 + lowestBit(bits);
+                return index < count ? index : -1;
+            }
+            if (++word > lastWord) return -1;
+            bits = value ? words[word] : ~words[word];
+        }
+    }
+
+    uint64_t bits = (value ? words[word] : ~words[word]) & (~uint64_t(0) >> (63 - from % 64));
+    while (true) {
+        if (bits) return word * 64 + highestBit(bits);
+        if (--word < 0) return -1;
+        bits = value ? words[word] : ~words[word];
+    }
+}
+
+static int jump(const uint64_t* words, int count, int from, int step) {
+    int next = from + step;
+    if (next < 0 || next >= count) return from;
+
+    int edge = step > 0 ? count - 1 : 0;
+    if (testBit(words, from) && testBit(words, next)) {
+        int empty = findBit(words, count, next, step, false);
+        return empty < 0 ? edge : empty - step;
+    }
+    int occupied = findBit(words, count, next, step, true);
+    return occupied < 0 ? edge : occupied;
+}
+
+Occupancy::Occupancy(int rows, int cols)
+    : rows(rows), cols(cols), rowStride((cols + 63) / 64), colStride((rows + 63) / 64),
+      rowBits(static_cast<size_t>(rows) * rowStride, 0), colBits(static_cast<size_t>(cols) * colStride, 0),
+      rowCounts(rows, 0), colCounts(cols, 0),
+      rowSummary((rows + 63) / 64, 0), colSummary((cols + 63) / 64, 0) {
+}
+
+void Occupancy::set(int row, int col, bool occupied) {
+    if (row < 0 || row >= rows || col < 0 || col >= cols || test(row, col) == occupied) return;
+
+    setBit(&rowBits[static_cast<size_t>(row) * rowStride], col, occupied);
+    setBit(&colBits[static_cast<size_t>(col) * colStride], row, occupied);
+    rowCounts[row] += occupied ? 1 : -1;
+    colCounts[col] += occupied ? 1 : -1;
+    setBit(rowSummary.data(), row, rowCounts[row] > 0);
+    setBit(colSummary.data(), col, colCounts[col] > 0);
+}
+
+void Occupancy::clear() {
+    std::fill(rowBits.begin(), rowBits.end(), 0);
+    std::fill(colBits.begin(), colBits.end(), 0);
+    std::fill(rowCounts.begin(), rowCounts.end(), 0);
+    std::fill(colCounts.begin(), colCounts.end(), 0);
+    std::fill(rowSummary.begin(), rowSummary.end(), 0);
+    std::fill(colSummary.begin(), colSummary.end(), 0);
+}
+
+bool Occupancy::test(int row, int col) const {
+    if (row < 0 || row >= rows || col < 0 || col >= cols) return false;
+    return testBit(rowWords(row), col);
+}
+
+bool Occupancy::rowOccupied(int row) const {
+    return row >= 0 && row < rows && rowCounts[row] > 0;
+}
+
+int Occupancy::lastRow() const {
+    return findBit(rowSummary.data(), rows, rows - 1, -1, true);
+}
+
+int Occupancy::lastCol() const {
+    return findBit(colSummary.data(), cols, cols - 1, -1, true);
+}
+
+int Occupancy::jumpInRow(int row, int col, int step) const {
+    if (row < 0 || row >= rows) return col;
+    return jump(rowWords(row), cols, col, step);
+}
+
+int Occupancy::jumpInCol(int row, int col, int step) const {
+    if (col < 0 || col >= cols) return row;
+    return jump(colWords(col), rows, row, step);
+}
+
+bool Occupancy::next(int& row, int& col) const {
+    if (row < 0) {
+        row = 0;
+        col = -1;
+    }
+    while (row < rows) {
+        if (rowCounts[row] > 0) {
+            int found = findBit(rowWords(row), cols, col + 1, 1, true);
+            if (found >= 0) {
+                col = found;
+                return true;
+            }
+        }
+        row = findBit(rowSummary.data(), rows, row + 1, 1, true);
+        if (row < 0) break;
+        col = -1;
+    }
+    return false;
+}
+
+size_t Occupancy::memoryUsage() const {
+    return vectorBytes(rowBits) + vectorBytes(colBits) + vectorBytes(rowCounts) + vectorBytes(colCounts) + vectorBytes(rowSummary) + vectorBytes(colSummary);
+}
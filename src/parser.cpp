@@ -1,36 +1,682 @@
 #include "parser.h"
 #include "matrix.h"
+#include <algorithm>
 #include <cctype>
+#include <cmath>
 #include <cstdlib>
 
-double parseValue(const std::string& text, const Matrix& matrix) {
-    (void)matrix;
+struct ParseState {
+    std::string_view text;
+    size_t pos;
+    const Matrix* matrix;
+    std::vector<RangeRef>* refs;
+    bool ok;
+};
 
-    if (text.empty()) return 0.0;
+static double parseExpression(ParseState& st);
 
-    size_t pos = 0;
-    bool hasDigit = false;
-    bool hasDot = false;
+static void skipSpaces(ParseState& st) {
+    while (st.pos < st.text.length() && st.text[st.pos] == ' ') {
+        st.pos++;
+    }
+}
 
-    if (text[pos] == '+' || text[pos] == '-') {
-        pos++;
+static bool parseCellRef(ParseState& st, int& row, int& col) {
+    size_t i = st.pos;
+    int c = 0;
+    while (i < st.text.length() && std::isalpha(static_cast<unsigned char>(st.text[i]))) {
+        c = c * 26 + (std::toupper(static_cast<unsigned char>(st.text[i])) - 'A' + 1);
+        i++;
+    }
+    if (i == st.pos || i >= st.text.length() || !std::isdigit(static_cast<unsigned char>(st.text[i]))) {
+        return false;
+    }
+    int r = 0;
+    while (i < st.text.length() && std::isdigit(static_cast<unsigned char>(st.text[i]))) {
+        r = r * 10 + (st.text[i] - '0');
+        i++;
+    }
+    if (r == 0 || r > MAX_ROWS || c > MAX_COLS) {
+        return false;
     }
+    row = r - 1;
+    col = c - 1;
+    st.pos = i;
+    return true;
+}
+
+static void parseSheetPrefix(ParseState& st, std::string& sheet) {
+    size_t i = st.pos;
+    while (i < st.text.length() && (std::isalnum(static_cast<unsigned char>(st.text[i])) || st.text[i] == '_')) {
+        i++;
+    }
+    if (i == st.pos || i >= st.text.length() || st.text[i] != '!') {
+        return;
+    }
+    sheet = std::string(st.text.substr(st.pos, i - st.pos));
+    std::transform(sheet.begin(), sheet.end(), sheet.begin(), [](unsigned char ch) { return std::toupper(ch); });
+    st.pos = i + 1;
+}
+
+static bool parseRange(ParseState& st, RangeRef& range) {
+    size_t start = st.pos;
+    parseSheetPrefix(st, range.sheet);
+    if (!parseCellRef(st, range.row1, range.col1)) {
+        st.pos = start;
+        return false;
+    }
+    range.row2 = range.row1;
+    range.col2 = range.col1;
+
+    size_t save = st.pos;
+    if (st.pos < st.text.length() && st.text[st.pos] == ':') {
+        st.pos++;
+    } else {
+        while (st.pos < st.text.length() && st.text[st.pos] == '.' && st.pos - save < 3) {
+            st.pos++;
+        }
+    }
+    if (st.pos > save) {
+        if (!parseCellRef(st, range.row2, range.col2)) {
+            st.pos = start;
+            return false;
+        }
+        if (range.row1 > range.row2) std::swap(range.row1, range.row2);
+        if (range.col1 > range.col2) std::swap(range.col1, range.col2);
+    }
+
+    if (st.refs) {
+        st.refs->push_back(range);
+    }
+    return true;
+}
 
-    while (pos < text.length()) {
-        if (std::isdigit(text[pos])) {
-            hasDigit = true;
-            pos++;
-        } else if (text[pos] == '.' && !hasDot) {
-            hasDot = true;
-            pos++;
+static double numberAt(const Matrix* source, int row, int col) {
+    if (!source) return 0.0;
+    const Cell* cell = source->getCellPtr(row, col);
+    if (cell && cell->type == CellType::Value) {
+        return cell->getValue();
+    }
+    return 0.0;
+}
+
+static double cellValue(const ParseState& st, const RangeRef& ref) {
+    const Matrix* source = st.matrix ? st.matrix->referencedSheet(ref) : nullptr;
+    return numberAt(source, ref.row1, ref.col1);
+}
+
+static double parseFunction(ParseState& st) {
+    size_t start = st.pos;
+    while (st.pos < st.text.length() && std::isalpha(static_cast<unsigned char>(st.text[st.pos]))) {
+        st.pos++;
+    }
+    std::string name(st.text.substr(start, st.pos - start));
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char ch) { return std::toupper(ch); });
+
+    if (name == "PI") {
+        return 3.14159265358979323846;
+    }
+
+    skipSpaces(st);
+    if (st.pos >= st.text.length() || st.text[st.pos] != '(') {
+        st.ok = false;
+        return 0.0;
+    }
+    st.pos++;
+
+    double sum = 0.0;
+    double minVal = 0.0;
+    double maxVal = 0.0;
+    int count = 0;
+    double single = 0.0;
+
+    while (true) {
+        skipSpaces(st);
+        RangeRef range;
+        size_t argStart = st.pos;
+        bool isRange = parseRange(st, range);
+        if (isRange) {
+            skipSpaces(st);
+            if (st.pos < st.text.length() && st.text[st.pos] != ',' && st.text[st.pos] != ')') {
+                if (st.refs) st.refs->pop_back();
+                st.pos = argStart;
+                isRange = false;
+            }
+        }
+
+        if (isRange) {
+            const Matrix* source = st.matrix ? st.matrix->referencedSheet(range) : nullptr;
+            const AggregateState* aggregate = source ? st.matrix->sourceAggregate(source, range) : nullptr;
+            if (aggregate) {
+                if (aggregate->count > 0) {
+                    if (count == 0 || aggregate->minValue() < minVal) minVal = aggregate->minValue();
+                    if (count == 0 || aggregate->maxValue() > maxVal) maxVal = aggregate->maxValue();
+                    sum += aggregate->sum;
+                    count += aggregate->count;
+                }
+            } else {
+                for (int r = range.row1; r <= range.row2; r++) {
+                    for (int c = range.col1; c <= range.col2; c++) {
+                        const Cell* cell = source ? source->getCellPtr(r, c) : nullptr;
+                        if (!cell || cell->type != CellType::Value) continue;
+                        double v = cell->getValue();
+                        if (count == 0 || v < minVal) minVal = v;
+                        if (count == 0 || v > maxVal) maxVal = v;
+                        sum += v;
+                        count++;
+                    }
+                }
+            }
         } else {
+            double v = parseExpression(st);
+            if (!st.ok) return 0.0;
+            if (count == 0 || v < minVal) minVal = v;
+            if (count == 0 || v > maxVal) maxVal = v;
+            sum += v;
+            count++;
+            single = v;
+        }
+
+        skipSpaces(st);
+        if (st.pos < st.text.length() && st.text[st.pos] == ',') {
+            st.pos++;
+            continue;
+        }
+        if (st.pos < st.text.length() && st.text[st.pos] == ')') {
+            st.pos++;
             break;
         }
+        st.ok = false;
+        return 0.0;
     }
 
-    if (hasDigit && pos == text.length()) {
-        return std::stod(text);
+    if (name == "SUM") return sum;
+    if (name == "COUNT") return count;
+    if (name == "MIN") return minVal;
+    if (name == "MAX") return maxVal;
+    if (name == "AVERAGE") return count > 0 ? sum / count : 0.0;
+    if (name == "ABS") return std::fabs(single);
+    if (name == "INT") return std::trunc(single);
+    if (name == "SQRT") return std::sqrt(single);
+
+    st.ok = false;
+    return 0.0;
+}
+
+static double parsePrimary(ParseState& st) {
+    skipSpaces(st);
+    if (st.pos >= st.text.length()) {
+        st.ok = false;
+        return 0.0;
+    }
+
+    char ch = st.text[st.pos];
+    if (ch == '(') {
+        st.pos++;
+        double v = parseExpression(st);
+        skipSpaces(st);
+        if (st.pos >= st.text.length() || st.text[st.pos] != ')') {
+            st.ok = false;
+            return 0.0;
+        }
+        st.pos++;
+        return v;
+    }
+    if (ch == '@') {
+        st.pos++;
+        return parseFunction(st);
+    }
+    if (std::isdigit(static_cast<unsigned char>(ch)) || ch == '.') {
+        std::string number(st.text.substr(st.pos));
+        char* stop = nullptr;
+        double v = std::strtod(number.c_str(), &stop);
+        if (stop == number.c_str()) {
+            st.ok = false;
+            return 0.0;
+        }
+        st.pos += stop - number.c_str();
+        return v;
+    }
+    if (std::isalnum(static_cast<unsigned char>(ch)) || ch == '_') {
+        RangeRef ref;
+        size_t start = st.pos;
+        parseSheetPrefix(st, ref.sheet);
+        if (parseCellRef(st, ref.row1, ref.col1)) {
+            ref.row2 = ref.row1;
+            ref.col2 = ref.col1;
+            if (st.refs) {
+                st.refs->push_back(ref);
+            }
+            return cellValue(st, ref);
+        }
+        st.pos = start;
     }
 
+    st.ok = false;
     return 0.0;
 }
+
+static double parseUnary(ParseState& st) {
+    skipSpaces(st);
+    if (st.pos < st.text.length() && (st.text[st.pos] == '+' || st.text[st.pos] == '-')) {
+        bool negate = st.text[st.pos] == '-';
+        st.pos++;
+        double v = parseUnary(st);
+        return negate ? -v : v;
+    }
+    return parsePrimary(st);
+}
+
+static double parsePower(ParseState& st) {
+    double v = parseUnary(st);
+    skipSpaces(st);
+    while (st.ok && st.pos < st.text.length() && st.text[st.pos] == '^') {
+        st.pos++;
+        v = std::pow(v, parseUnary(st));
+        skipSpaces(st);
+    }
+    return v;
+}
+
+static double parseTerm(ParseState& st) {
+    double v = parsePower(st);
+    skipSpaces(st);
+    while (st.ok && st.pos < st.text.length() && (st.text[st.pos] == '*' || st.text[st.pos] == '/')) {
+        char op = st.text[st.pos++];
+        double rhs = parsePower(st);
+        v = (op == '*') ? v * rhs : v / rhs;
+        skipSpaces(st);
+    }
+    return v;
+}
+
+static double parseExpression(ParseState& st) {
+    double v = parseTerm(st);
+    skipSpaces(st);
+    while (st.ok && st.pos < st.text.length() && (st.text[st.pos] == '+' || st.text[st.pos] == '-')) {
+        char op = st.text[st.pos++];
+        double rhs = parseTerm(st);
+        v = (op == '+') ? v + rhs : v - rhs;
+        skipSpaces(st);
+    }
+    return v;
+}
+
+double parseValue(std::string_view text, const Matrix& matrix) {
+    if (text.empty()) return 0.0;
+
+    ParseState st{text, 0, &matrix, nullptr, true};
+    double v = parseExpression(st);
+    if (!st.ok || st.pos != text.length()) {
+        return 0.0;
+    }
+    return v;
+}
+
+void collectReferences(std::string_view text, std::vector<RangeRef>& refs) {
+    if (text.empty()) return;
+
+    ParseState st{text, 0, nullptr, &refs, true};
+    parseExpression(st);
+}
+
+bool parseRangeAddress(std::string_view text, RangeRef& range) {
+    ParseState st{text, 0, nullptr, nullptr, true};
+    skipSpaces(st);
+    if (!parseRange(st, range)) return false;
+    skipSpaces(st);
+    return st.pos == text.length();
+}
+
+struct ArrayState {
+    ParseState parse;
+    ArrayProgram& program;
+    int stack;
+};
+
+static void compileComparison(ArrayState& st);
+
+static void emit(ArrayState& st, ArrayOpCode code, int pushed, double number = 0.0, int ref = -1) {
+    st.program.ops.push_back({code, number, ref});
+    st.stack += pushed;
+    st.program.depth = std::max(st.program.depth, st.stack);
+}
+
+static bool consume(ArrayState& st, char ch) {
+    skipSpaces(st.parse);
+    if (st.parse.pos < st.parse.text.length() && st.parse.text[st.parse.pos] == ch) {
+        st.parse.pos++;
+        return true;
+    }
+    return false;
+}
+
+static void compileFunction(ArrayState& st) {
+    ParseState& ps = st.parse;
+    size_t start = ps.pos;
+    while (ps.pos < ps.text.length() && std::isalpha(static_cast<unsigned char>(ps.text[ps.pos]))) {
+        ps.pos++;
+    }
+    std::string name(ps.text.substr(start, ps.pos - start));
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char ch) { return std::toupper(ch); });
+
+    if (name == "PI") {
+        emit(st, ArrayOpCode::Number, 1, 3.14159265358979323846);
+        return;
+    }
+
+    int arguments = name == "IF" ? 3 : 1;
+    ArrayOpCode code = ArrayOpCode::If;
+    if (name == "ABS") code = ArrayOpCode::Abs;
+    else if (name == "INT") code = ArrayOpCode::Int;
+    else if (name == "SQRT") code = ArrayOpCode::Sqrt;
+    else if (name != "IF") ps.ok = false;
+
+    if (!ps.ok || !consume(st, '(')) {
+        ps.ok = false;
+        return;
+    }
+    for (int i = 0; i < arguments; i++) {
+        if (i > 0 && !consume(st, ',')) {
+            ps.ok = false;
+            return;
+        }
+        compileComparison(st);
+        if (!ps.ok) return;
+    }
+    if (!consume(st, ')')) {
+        ps.ok = false;
+        return;
+    }
+    emit(st, code, 1 - arguments);
+}
+
+static void compilePrimary(ArrayState& st) {
+    ParseState& ps = st.parse;
+    skipSpaces(ps);
+    if (ps.pos >= ps.text.length()) {
+        ps.ok = false;
+        return;
+    }
+
+    char ch = ps.text[ps.pos];
+    if (ch == '(') {
+        ps.pos++;
+        compileComparison(st);
+        if (!consume(st, ')')) ps.ok = false;
+        return;
+    }
+    if (ch == '@') {
+        ps.pos++;
+        compileFunction(st);
+        return;
+    }
+    if (std::isdigit(static_cast<unsigned char>(ch)) || ch == '.') {
+        std::string number(ps.text.substr(ps.pos));
+        char* stop = nullptr;
+        double v = std::strtod(number.c_str(), &stop);
+        if (stop == number.c_str()) {
+            ps.ok = false;
+            return;
+        }
+        ps.pos += stop - number.c_str();
+        emit(st, ArrayOpCode::Number, 1, v);
+        return;
+    }
+    RangeRef range;
+    if (parseRange(ps, range)) {
+        st.program.refs.push_back(range);
+        emit(st, ArrayOpCode::Range, 1, 0.0, static_cast<int>(st.program.refs.size()) - 1);
+        return;
+    }
+    ps.ok = false;
+}
+
+static void compileUnary(ArrayState& st) {
+    skipSpaces(st.parse);
+    if (consume(st, '-')) {
+        compileUnary(st);
+        emit(st, ArrayOpCode::Negate, 0);
+        return;
+    }
+    if (consume(st, '+')) {
+        compileUnary(st);
+        return;
+    }
+    compilePrimary(st);
+}
+
+static void compilePower(ArrayState& st) {
+    compileUnary(st);
+    while (st.parse.ok && consume(st, '^')) {
+        compileUnary(st);
+        emit(st, ArrayOpCode::Power, -1);
+    }
+}
+
+static void compileTerm(ArrayState& st) {
+    compilePower(st);
+    while (st.parse.ok) {
+        if (consume(st, '*')) {
+            compilePower(st);
+            emit(st, ArrayOpCode::Multiply, -1);
+        } else if (consume(st, '/')) {
+            compilePower(st);
+            emit(st, ArrayOpCode::Divide, -1);
+        } else {
+            break;
+        }
+    }
+}
+
+static void compileExpression(ArrayState& st) {
+    compileTerm(st);
+    while (st.parse.ok) {
+        if (consume(st, '+')) {
+            compileTerm(st);
+            emit(st, ArrayOpCode::Add, -1);
+        } else if (consume(st, '-')) {
+            compileTerm(st);
+            emit(st, ArrayOpCode::Subtract, -1);
+        } else {
+            break;
+        }
+    }
+}
+
+static void compileComparison(ArrayState& st) {
+    compileExpression(st);
+    if (!st.parse.ok) return;
+
+    ArrayOpCode code;
+    if (consume(st, '<')) {
+        if (consume(st, '=')) code = ArrayOpCode::LessEqual;
+        else if (consume(st, '>')) code = ArrayOpCode::NotEqual;
+        else code = ArrayOpCode::Less;
+    } else if (consume(st, '>')) {
+        code = consume(st, '=') ? ArrayOpCode::GreaterEqual : ArrayOpCode::Greater;
+    } else if (consume(st, '=')) {
+        code = ArrayOpCode::Equal;
+    } else {
+        return;
+    }
+    compileExpression(st);
+    emit(st, code, -1);
+}
+
+bool isValueTrigger(int ch) {
+    if (ch < 0 || ch > 127) return false;
+    return std::isdigit(ch) || ch == '+' || ch == '-' || ch == '(' || ch == '.' || ch == '#' || ch == '@' || ch == '{';
+}
+
+bool isArrayFormula(std::string_view text) {
+    return !text.empty() && text[0] == '{';
+}
+
+bool compileArray(std::string_view text, ArrayProgram& program) {
+    program = ArrayProgram();
+    if (!isArrayFormula(text)) return false;
+
+    ArrayState st{{text, 1, nullptr, nullptr, true}, program, 0};
+    compileComparison(st);
+    if (!st.parse.ok || !consume(st, '}')) return false;
+    skipSpaces(st.parse);
+    if (st.parse.pos != text.length()) return false;
+
+    for (const RangeRef& ref : program.refs) {
+        program.rows = std::max(program.rows, ref.row2 - ref.row1 + 1);
+        program.cols = std::max(program.cols, ref.col2 - ref.col1 + 1);
+    }
+    for (const RangeRef& ref : program.refs) {
+        int rows = ref.row2 - ref.row1 + 1;
+        int cols = ref.col2 - ref.col1 + 1;
+        if ((rows != 1 && rows != program.rows) || (cols != 1 && cols != program.cols)) {
+            program.rows = 1;
+            program.cols = 1;
+            return false;
+        }
+    }
+    program.valid = true;
+    return true;
+}
+
+struct ArraySlot {
+    bool scalar = true;
+    double value = 0.0;
+    std::vector<double> data;
+};
+
+static void broadcast(ArraySlot& slot, size_t rows) {
+    if (!slot.scalar) return;
+    slot.data.assign(rows, slot.value);
+    slot.scalar = false;
+}
+
+template <typename Op>
+static void applyUnary(ArraySlot& a, Op op) {
+    if (a.scalar) {
+        a.value = op(a.value);
+        return;
+    }
+    double* x = a.data.data();
+    for (size_t i = 0; i < a.data.size(); i++) {
+        x[i] = op(x[i]);
+    }
+}
+
+template <typename Op>
+static void applyBinary(ArraySlot& a, ArraySlot& b, size_t rows, Op op) {
+    if (a.scalar && b.scalar) {
+        a.value = op(a.value, b.value);
+        return;
+    }
+    broadcast(a, rows);
+    broadcast(b, rows);
+    double* x = a.data.data();
+    const double* y = b.data.data();
+    for (size_t i = 0; i < rows; i++) {
+        x[i] = op(x[i], y[i]);
+    }
+}
+
+static void applySelect(ArraySlot& c, ArraySlot& a, ArraySlot& b, size_t rows) {
+    if (c.scalar && a.scalar && b.scalar) {
+        c.value = c.value != 0.0 ? a.value : b.value;
+        return;
+    }
+    broadcast(c, rows);
+    broadcast(a, rows);
+    broadcast(b, rows);
+    double* x = c.data.data();
+    const double* y = a.data.data();
+    const double* z = b.data.data();
+    for (size_t i = 0; i < rows; i++) {
+        x[i] = x[i] != 0.0 ? y[i] : z[i];
+    }
+}
+
+static void loadColumn(ArraySlot& slot, const RangeRef& ref, const Matrix* source, int column, size_t rows) {
+    int col = ref.col2 > ref.col1 ? ref.col1 + column : ref.col1;
+    if (ref.row1 == ref.row2) {
+        slot.scalar = true;
+        slot.value = numberAt(source, ref.row1, col);
+        return;
+    }
+    slot.scalar = false;
+    slot.data.resize(rows);
+    double* x = slot.data.data();
+    for (size_t i = 0; i < rows; i++) {
+        x[i] = numberAt(source, ref.row1 + static_cast<int>(i), col);
+    }
+}
+
+void evaluateArray(const ArrayProgram& program, const Matrix& matrix, std::vector<double>& values) {
+    size_t rows = static_cast<size_t>(program.rows);
+    size_t cols = static_cast<size_t>(program.cols);
+    values.assign(rows * cols, 0.0);
+    if (!program.valid) return;
+
+    std::vector<const Matrix*> sources;
+    for (const RangeRef& ref : program.refs) {
+        sources.push_back(matrix.referencedSheet(ref));
+    }
+
+    std::vector<ArraySlot> stack(static_cast<size_t>(program.depth));
+    for (size_t column = 0; column < cols; column++) {
+        size_t top = 0;
+        for (const ArrayOp& op : program.ops) {
+            switch (op.code) {
+                case ArrayOpCode::Number:
+                    stack[top].scalar = true;
+                    stack[top].value = op.number;
+                    top++;
+                    break;
+                case ArrayOpCode::Range:
+                    loadColumn(stack[top], program.refs[op.ref], sources[op.ref], static_cast<int>(column), rows);
+                    top++;
+                    break;
+                case ArrayOpCode::Negate:
+                    applyUnary(stack[top - 1], [](double x) { return -x; });
+                    break;
+                case ArrayOpCode::Abs:
+                    applyUnary(stack[top - 1], [](double x) { return std::fabs(x); });
+                    break;
+                case ArrayOpCode::Int:
+                    applyUnary(stack[top - 1], [](double x) { return std::trunc(x); });
+                    break;
+                case ArrayOpCode::Sqrt:
+                    applyUnary(stack[top - 1], [](double x) { return std::sqrt(x); });
+                    break;
+                case ArrayOpCode::If:
+                    applySelect(stack[top - 3], stack[top - 2], stack[top - 1], rows);
+                    top -= 2;
+                    break;
+                default: {
+                    ArraySlot& a = stack[top - 2];
+                    ArraySlot& b = stack[top - 1];
+                    switch (op.code) {
+                        case ArrayOpCode::Add: applyBinary(a, b, rows, [](double x, double y) { return x + y; }); break;
+                        case ArrayOpCode::Subtract: applyBinary(a, b, rows, [](double x, double y) { return x - y; }); break;
+                        case ArrayOpCode::Multiply: applyBinary(a, b, rows, [](double x, double y) { return x * y; }); break;
+                        case ArrayOpCode::Divide: applyBinary(a, b, rows, [](double x, double y) { return x / y; }); break;
+                        case ArrayOpCode::Power: applyBinary(a, b, rows, [](double x, double y) { return std::pow(x, y); }); break;
+                        case ArrayOpCode::Less: applyBinary(a, b, rows, [](double x, double y) { return x < y ? 1.0 : 0.0; }); break;
+                        case ArrayOpCode::LessEqual: applyBinary(a, b, rows, [](double x, double y) { return x <= y ? 1.0 : 0.0; }); break;
+                        case ArrayOpCode::Greater: applyBinary(a, b, rows, [](double x, double y) { return x > y ? 1.0 : 0.0; }); break;
+                        case ArrayOpCode::GreaterEqual: applyBinary(a, b, rows, [](double x, double y) { return x >= y ? 1.0 : 0.0; }); break;
+                        case ArrayOpCode::Equal: applyBinary(a, b, rows, [](double x, double y) { return x == y ? 1.0 : 0.0; }); break;
+                        case ArrayOpCode::NotEqual: applyBinary(a, b, rows, [](double x, double y) { return x != y ? 1.0 : 0.0; }); break;
+                        default: break;
+                    }
+                    top--;
+                    break;
+                }
+            }
+        }
+
+        const ArraySlot& result = stack[0];
+        for (size_t i = 0; i < rows; i++) {
+            values[i * cols + column] = result.scalar ? result.value : result.data[i];
+        }
+    }
+}
@@ -0,0 +1,211 @@
+#include "search.h"
+#include "cell.h"
+#include "memory.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+static std::string lowercase(std::string_view text) {
+    std::string result(text);
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char ch) { return std::tolower(ch); });
+    return result;
+}
+
+static uint32_t trigram(unsigned char a, unsigned char b, unsigned char c) {
+    return (static_cast<uint32_t>(a) << 16) | (static_cast<uint32_t>(b) << 8) | c;
+}
+
+static std::vector<uint32_t> gramsOf(std::string_view text) {
+    std::vector<uint32_t> result;
+    for (size_t i = 0; i + 2 < text.length(); i++) {
+        result.push_back(trigram(text[i], text[i + 1], text[i + 2]));
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+static void insertKey(std::pmr::vector<int>& keys, int key) {
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    if (it == keys.end() || *it != key) {
+        keys.insert(it, key);
+    }
+}
+
+static void eraseKey(std::pmr::vector<int>& keys, int key) {
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    if (it != keys.end() && *it == key) {
+        keys.erase(it);
+    }
+}
+
+static int columnMajor(int key) {
+    return (key % MAX_COLS) * MAX_ROWS + key / MAX_COLS;
+}
+
+static int distanceAfter(int key, int afterKey, bool columnOrder) {
+    int span = MAX_ROWS * MAX_COLS;
+    int order = columnOrder ? columnMajor(key) : key;
+    int after = columnOrder ? columnMajor(afterKey) : afterKey;
+    return (order - after - 1 + span) % span;
+}
+
+SearchIndex::SearchIndex() : index(createPostings()) {
+}
+
+SearchIndex::Postings* SearchIndex::createPostings() {
+    std::pmr::polymorphic_allocator<Postings> alloc(&arena);
+    Postings* result = alloc.allocate(1);
+    alloc.construct(result);
+    return result;
+}
+
+void SearchIndex::addGram(uint32_t gram, int key) {
+    insertKey(index->grams[gram], key);
+}
+
+void SearchIndex::removeGram(uint32_t gram, int key) {
+    auto it = index->grams.find(gram);
+    if (it == index->grams.end()) return;
+    eraseKey(it->second, key);
+    if (it->second.empty()) {
+        index->grams.erase(it);
+    }
+}
+
+void SearchIndex::addLabel(int key, std::string_view text) {
+    std::string lower = lowercase(text);
+    for (uint32_t gram : gramsOf(lower)) {
+        addGram(gram, key);
+    }
+    index->labels[key] = lower;
+}
+
+void SearchIndex::removeLabel(int key) {
+    auto it = index->labels.find(key);
+    if (it == index->labels.end()) return;
+    for (uint32_t gram : gramsOf(it->second)) {
+        removeGram(gram, key);
+    }
+    index->labels.erase(it);
+}
+
+void SearchIndex::addValue(int key, double value) {
+    if (!std::isfinite(value)) return;
+    insertKey(index->values[value], key);
+}
+
+void SearchIndex::removeValue(int key, double value) {
+    auto it = index->values.find(value);
+    if (it == index->values.end()) return;
+    eraseKey(it->second, key);
+    if (it->second.empty()) {
+        index->values.erase(it);
+    }
+}
+
+void SearchIndex::clear() {
+    arena.release();
+    index = createPostings();
+}
+
+const std::pmr::vector<int>* SearchIndex::labelCandidates(const std::string& query) const {
+    const std::pmr::vector<int>* best = nullptr;
+    for (size_t i = 0; i + 2 < query.length(); i++) {
+        auto it = index->grams.find(trigram(query[i], query[i + 1], query[i + 2]));
+        if (it == index->grams.end()) return nullptr;
+        if (!best || it->second.size() < best->size()) {
+            best = &it->second;
+        }
+    }
+    return best;
+}
+
+bool SearchIndex::nextIn(const std::pmr::vector<int>& keys, const std::string* query, int afterKey, bool columnOrder, int& result) const {
+    auto matches = [&](int key) {
+        if (!query) return true;
+        auto label = index->labels.find(key);
+        return label != index->labels.end() && label->second.find(*query) != std::string::npos;
+    };
+
+    if (!columnOrder) {
+        for (auto it = std::upper_bound(keys.begin(), keys.end(), afterKey); it != keys.end(); ++it) {
+            if (matches(*it)) {
+                result = *it;
+                return true;
+            }
+        }
+        for (auto it = keys.begin(); it != keys.end() && *it <= afterKey; ++it) {
+            if (matches(*it)) {
+                result = *it;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int after = columnMajor(afterKey);
+    int bestAfter = -1;
+    int bestWrapped = -1;
+    for (int key : keys) {
+        int order = columnMajor(key);
+        if (order > after) {
+            if ((bestAfter < 0 || order < columnMajor(bestAfter)) && matches(key)) bestAfter = key;
+        } else if ((bestWrapped < 0 || order < columnMajor(bestWrapped)) && matches(key)) {
+            bestWrapped = key;
+        }
+    }
+    result = bestAfter >= 0 ? bestAfter : bestWrapped;
+    return result >= 0;
+}
+
+bool SearchIndex::nextLabel(const std::string& query, int afterKey, bool columnOrder, int& result) const {
+    if (query.length() >= 3) {
+        const std::pmr::vector<int>* candidates = labelCandidates(query);
+        return candidates && nextIn(*candidates, &query, afterKey, columnOrder, result);
+    }
+
+    int best = -1;
+    for (const auto& label : index->labels) {
+        if (label.second.find(query) == std::string::npos) continue;
+        if (best < 0 || distanceAfter(label.first, afterKey, columnOrder) < distanceAfter(best, afterKey, columnOrder)) {
+            best = label.first;
+        }
+    }
+    result = best;
+    return best >= 0;
+}
+
+bool SearchIndex::findNext(const std::string& query, int afterKey, bool columnOrder, int& result) const {
+    if (query.empty()) return false;
+
+    std::string lower = lowercase(query);
+    bool found = false;
+    int labelMatch = -1;
+    if (nextLabel(lower, afterKey, columnOrder, labelMatch)) {
+        found = true;
+        result = labelMatch;
+    }
+
+    char* end = nullptr;
+    double number = std::strtod(query.c_str(), &end);
+    if (end != query.c_str() && *end == '\0' && std::isfinite(number)) {
+        auto it = index->values.find(number);
+        int valueMatch = -1;
+        if (it != index->values.end() && nextIn(it->second, nullptr, afterKey, columnOrder, valueMatch)) {
+            if (!found) {
+                result = valueMatch;
+                found = true;
+            } else if (distanceAfter(valueMatch, afterKey, columnOrder) < distanceAfter(labelMatch, afterKey, columnOrder)) {
+                result = valueMatch;
+            }
+        }
+    }
+    return found;
+}
+
+size_t SearchIndex::memoryUsage() const {
+    return usage.allocated();
+}
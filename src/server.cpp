@@ -0,0 +1,523 @@
+#include "server.h"
+#include "display.h"
+#include "matrix.h"
+#include "parser.h"
+#include "workbook.h"
+#include <iostream>
+
+#ifdef _WIN32
+
+int runServer(const std::string& socketPath, const std::string& filename) {
+    (void)socketPath;
+    (void)filename;
+    std::cerr << "Server mode is not supported on this platform\n";
+    return 1;
+}
+
+#else
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct SnapshotCell {
+    CellType type = CellType::Empty;
+    std::string text;
+    double value = 0.0;
+};
+
+using SnapshotChunk = std::unordered_map<int, SnapshotCell>;
+
+struct Snapshot {
+    unsigned long long version = 0;
+    std::vector<std::shared_ptr<const SnapshotChunk>> chunks;
+
+    const SnapshotCell* find(int row, int col) const {
+        const SnapshotChunk& chunk = *chunks[row / SNAPSHOT_CHUNK_ROWS];
+        auto it = chunk.find(row * MAX_COLS + col);
+        return it == chunk.end() ? nullptr : &it->second;
+    }
+};
+
+enum class WriteKind {
+    Set,
+    Clear,
+    Recalc,
+    Save
+};
+
+struct WriteRequest {
+    WriteKind kind = WriteKind::Recalc;
+    RangeRef range;
+    std::string text;
+    std::promise<std::string> reply;
+};
+
+struct Client {
+    int fd = -1;
+    std::mutex outboxMutex;
+    std::condition_variable outboxReady;
+    std::deque<std::string> outbox;
+    size_t outboxBytes = 0;
+    bool subscribed = false;
+    bool resync = false;
+    bool closing = false;
+    std::atomic<bool> finished{false};
+    std::thread thread;
+};
+
+static std::string formatCell(int row, int col, const SnapshotCell* cell) {
+    std::ostringstream out;
+    out << columnLabel(col) << (row + 1) << ' ';
+    if (cell) {
+        out << cellTypeChar(cell->type) << ' ' << cell->value << ' ' << cell->text;
+    } else {
+        out << "E 0 ";
+    }
+    return out.str();
+}
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.length()) {
+        ssize_t n = send(fd, data.data() + sent, data.length() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+class SheetServer {
+public:
+    explicit SheetServer(const std::string& path) : socketPath(path) {}
+    int run(const std::string& filename);
+
+private:
+    std::shared_ptr<const SnapshotChunk> buildChunk(Matrix& matrix, int chunk) const;
+    void publish(Matrix& matrix, const std::vector<std::pair<int, int>>& changed);
+    void writerLoop();
+    std::string submit(std::unique_ptr<WriteRequest> request);
+    void serveClient(std::shared_ptr<Client> client);
+    void sendLoop(Client& client);
+    bool handleCommand(Client& client, const std::string& line);
+    void reply(Client& client, const std::string& text);
+    void flush(Client& client);
+    void notifySubscribers(const Snapshot& snapshot, const std::vector<std::pair<int, int>>& changed);
+    void reapClients();
+    void stop();
+
+    std::string socketPath;
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+
+    Workbook workbook;
+    std::shared_ptr<const Snapshot> snapshot;
+
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<std::unique_ptr<WriteRequest>> queue;
+
+    std::mutex clientsMutex;
+    std::vector<std::shared_ptr<Client>> clients;
+};
+
+std::shared_ptr<const SnapshotChunk> SheetServer::buildChunk(Matrix& matrix, int chunk) const {
+    auto result = std::make_shared<SnapshotChunk>();
+    int lastRow = std::min((chunk + 1) * SNAPSHOT_CHUNK_ROWS, MAX_ROWS);
+    for (int row = chunk * SNAPSHOT_CHUNK_ROWS; row < lastRow; row++) {
+        if (!matrix.rowOccupied(row)) continue;
+        for (int col = 0; col < MAX_COLS; col++) {
+            const Cell* cell = matrix.getCellPtr(row, col);
+            if (!cell || cell->isEmpty()) continue;
+            (*result)[row * MAX_COLS + col] = {cell->type, std::string(cell->text), cell->numericValue};
+        }
+    }
+    return result;
+}
+
+void SheetServer::publish(Matrix& matrix, const std::vector<std::pair<int, int>>& changed) {
+    auto current = std::atomic_load(&snapshot);
+    auto next = std::make_shared<Snapshot>(*current);
+    next->version++;
+
+    std::set<int> chunks;
+    for (const auto& cell : changed) {
+        chunks.insert(cell.first / SNAPSHOT_CHUNK_ROWS);
+    }
+    for (int chunk : chunks) {
+        next->chunks[chunk] = buildChunk(matrix, chunk);
+    }
+
+    std::atomic_store(&snapshot, std::shared_ptr<const Snapshot>(next));
+}
+
+void SheetServer::writerLoop() {
+    while (true) {
+        std::deque<std::unique_ptr<WriteRequest>> batch;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueReady.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            batch.swap(queue);
+        }
+
+        workbook.trimCache();
+        Matrix& matrix = workbook.activeSheet();
+        matrix.beginTransaction();
+        for (auto& request : batch) {
+            if (request->kind != WriteKind::Set && request->kind != WriteKind::Clear) continue;
+            for (int row = request->range.row1; row <= request->range.row2; row++) {
+                for (int col = request->range.col1; col <= request->range.col2; col++) {
+                    if (request->kind == WriteKind::Clear || request->text.empty()) {
+                        matrix.clearCell(row, col);
+                        continue;
+                    }
+                    Cell cell;
+                    if (isValueTrigger(request->text[0])) {
+                        cell.setValue(request->text, parseValue(request->text, matrix));
+                    } else {
+                        cell.setLabel(request->text);
+                    }
+                    matrix.setCell(row, col, cell);
+                }
+            }
+        }
+        matrix.commitTransaction(false);
+
+        std::vector<std::pair<int, int>> changed = matrix.pendingCells();
+        std::sort(changed.begin(), changed.end());
+        matrix.recalculate();
+        if (!changed.empty()) {
+            publish(matrix, changed);
+        }
+
+        auto current = std::atomic_load(&snapshot);
+        for (auto& request : batch) {
+            std::string result = "OK " + std::to_string(current->version);
+            if (request->kind == WriteKind::Save) {
+                bool saved = request->text.empty() ? workbook.saveToFile() : workbook.saveToFile(request->text);
+                if (!saved) result = "ERR save failed";
+            }
+            request->reply.set_value(result);
+        }
+
+        if (!changed.empty()) {
+            notifySubscribers(*current, changed);
+        }
+    }
+}
+
+std::string SheetServer::submit(std::unique_ptr<WriteRequest> request) {
+    std::future<std::string> result = request->reply.get_future();
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (stopping) return "ERR shutting down";
+        queue.push_back(std::move(request));
+    }
+    queueReady.notify_one();
+    return result.get();
+}
+
+void SheetServer::reply(Client& client, const std::string& text) {
+    {
+        std::unique_lock<std::mutex> lock(client.outboxMutex);
+        client.outboxReady.wait(lock, [&client] { return client.closing || client.outboxBytes < CLIENT_OUTBOX_LIMIT; });
+        if (client.closing) return;
+        client.outbox.push_back(text + "\n");
+        client.outboxBytes += client.outbox.back().length();
+    }
+    client.outboxReady.notify_all();
+}
+
+void SheetServer::flush(Client& client) {
+    std::unique_lock<std::mutex> lock(client.outboxMutex);
+    client.outboxReady.wait(lock, [&client] { return client.closing || client.outbox.empty(); });
+}
+
+void SheetServer::sendLoop(Client& client) {
+    while (true) {
+        std::string data;
+        size_t messages = 0;
+        {
+            std::unique_lock<std::mutex> lock(client.outboxMutex);
+            client.outboxReady.wait(lock, [&client] { return client.closing || !client.outbox.empty(); });
+            if (client.outbox.empty()) break;
+            messages = client.outbox.size();
+            data.reserve(client.outboxBytes);
+            for (const std::string& message : client.outbox) {
+                data += message;
+            }
+        }
+
+        bool sent = sendAll(client.fd, data);
+        {
+            std::lock_guard<std::mutex> lock(client.outboxMutex);
+            client.outbox.erase(client.outbox.begin(), client.outbox.begin() + messages);
+            client.outboxBytes -= data.length();
+            if (!sent) client.closing = true;
+            if (client.resync && client.subscribed && client.outboxBytes < CLIENT_OUTBOX_LIMIT / 2) {
+                client.outbox.push_back("RESYNC " + std::to_string(std::atomic_load(&snapshot)->version) + "\n");
+                client.outboxBytes += client.outbox.back().length();
+                client.resync = false;
+            }
+        }
+        client.outboxReady.notify_all();
+        if (!sent) break;
+    }
+    shutdown(client.fd, SHUT_RDWR);
+}
+
+void SheetServer::notifySubscribers(const Snapshot& current, const std::vector<std::pair<int, int>>& changed) {
+    std::string events;
+    for (const auto& cell : changed) {
+        events += "EVENT " + std::to_string(current.version) + " " + formatCell(cell.first, cell.second, current.find(cell.first, cell.second)) + "\n";
+    }
+
+    std::vector<std::shared_ptr<Client>> targets;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        targets = clients;
+    }
+    for (auto& client : targets) {
+        {
+            std::lock_guard<std::mutex> lock(client->outboxMutex);
+            if (!client->subscribed || client->closing) continue;
+            if (client->outboxBytes + events.length() > CLIENT_OUTBOX_LIMIT) {
+                client->resync = true;
+                continue;
+            }
+            if (client->resync) {
+                client->outbox.push_back("RESYNC " + std::to_string(current.version) + "\n");
+                client->outboxBytes += client->outbox.back().length();
+                client->resync = false;
+            }
+            client->outbox.push_back(events);
+            client->outboxBytes += events.length();
+        }
+        client->outboxReady.notify_all();
+    }
+}
+
+bool SheetServer::handleCommand(Client& client, const std::string& line) {
+    std::string command;
+    std::string args;
+    size_t space = line.find(' ');
+    command = line.substr(0, space);
+    if (space != std::string::npos) {
+        args = line.substr(space + 1);
+    }
+    std::transform(command.begin(), command.end(), command.begin(), [](unsigned char ch) { return std::toupper(ch); });
+
+    if (command.empty()) {
+        return true;
+    } else if (command == "GET") {
+        RangeRef range;
+        if (!parseRangeAddress(args, range) || !range.sheet.empty()) {
+            reply(client, "ERR bad address");
+            return true;
+        }
+        auto current = std::atomic_load(&snapshot);
+        if (range.row1 == range.row2 && range.col1 == range.col2) {
+            reply(client, "OK " + formatCell(range.row1, range.col1, current->find(range.row1, range.col1)));
+            return true;
+        }
+        std::vector<std::string> lines;
+        for (int row = range.row1; row <= range.row2; row++) {
+            for (int col = range.col1; col <= range.col2; col++) {
+                const SnapshotCell* cell = current->find(row, col);
+                if (cell) lines.push_back(formatCell(row, col, cell));
+            }
+        }
+        std::string text = "OK " + std::to_string(lines.size()) + " " + std::to_string(current->version);
+        for (const std::string& cellLine : lines) {
+            text += "\n" + cellLine;
+        }
+        reply(client, text);
+    } else if (command == "SET" || command == "CLEAR") {
+        std::string address = args.substr(0, args.find(' '));
+        auto request = std::make_unique<WriteRequest>();
+        request->kind = command == "SET" ? WriteKind::Set : WriteKind::Clear;
+        if (!parseRangeAddress(address, request->range) || !request->range.sheet.empty()) {
+            reply(client, "ERR bad address");
+            return true;
+        }
+        if (command == "SET" && address.length() < args.length()) {
+            request->text = args.substr(address.length() + 1);
+        }
+        reply(client, submit(std::move(request)));
+    } else if (command == "RECALC" || command == "SAVE") {
+        auto request = std::make_unique<WriteRequest>();
+        request->kind = command == "RECALC" ? WriteKind::Recalc : WriteKind::Save;
+        request->text = args;
+        reply(client, submit(std::move(request)));
+    } else if (command == "VERSION") {
+        reply(client, "OK " + std::to_string(std::atomic_load(&snapshot)->version));
+    } else if (command == "SUBSCRIBE" || command == "UNSUBSCRIBE") {
+        {
+            std::lock_guard<std::mutex> lock(client.outboxMutex);
+            client.subscribed = command == "SUBSCRIBE";
+            client.resync = false;
+        }
+        reply(client, "OK");
+    } else if (command == "QUIT") {
+        reply(client, "OK");
+        return false;
+    } else if (command == "SHUTDOWN") {
+        reply(client, "OK");
+        flush(client);
+        stop();
+        return false;
+    } else {
+        reply(client, "ERR unknown command");
+    }
+    return true;
+}
+
+void SheetServer::serveClient(std::shared_ptr<Client> client) {
+    std::thread sender(&SheetServer::sendLoop, this, std::ref(*client));
+    std::string buffer;
+    char data[4096];
+    bool open = true;
+    while (open) {
+        ssize_t n = recv(client->fd, data, sizeof(data), 0);
+        if (n <= 0) break;
+        buffer.append(data, static_cast<size_t>(n));
+
+        size_t newline;
+        while (open && (newline = buffer.find('\n')) != std::string::npos) {
+            std::string line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            open = handleCommand(*client, line);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(client->outboxMutex);
+        client->subscribed = false;
+        client->closing = true;
+    }
+    client->outboxReady.notify_all();
+    sender.join();
+    client->finished = true;
+}
+
+void SheetServer::reapClients() {
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    auto it = clients.begin();
+    while (it != clients.end()) {
+        if ((*it)->finished) {
+            (*it)->thread.join();
+            close((*it)->fd);
+            it = clients.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void SheetServer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueReady.notify_all();
+    shutdown(listenFd, SHUT_RDWR);
+}
+
+int SheetServer::run(const std::string& filename) {
+    if (socketPath.length() >= sizeof(sockaddr_un::sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath << "\n";
+        return 1;
+    }
+
+    if (!filename.empty()) {
+        workbook.loadFromFile(filename);
+    }
+    Matrix& matrix = workbook.activeSheet();
+    matrix.recalculate();
+
+    auto initial = std::make_shared<Snapshot>();
+    for (int chunk = 0; chunk * SNAPSHOT_CHUNK_ROWS < MAX_ROWS; chunk++) {
+        initial->chunks.push_back(buildChunk(matrix, chunk));
+    }
+    snapshot = initial;
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        std::cerr << "Cannot create socket: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(socketPath.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, 16) < 0) {
+        std::cerr << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+        close(listenFd);
+        return 1;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    std::thread writer(&SheetServer::writerLoop, this);
+
+    while (!stopping) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        reapClients();
+        auto client = std::make_shared<Client>();
+        client->fd = fd;
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        clients.push_back(client);
+        client->thread = std::thread(&SheetServer::serveClient, this, client);
+    }
+
+    stop();
+    writer.join();
+
+    std::vector<std::shared_ptr<Client>> remaining;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        remaining.swap(clients);
+    }
+    for (auto& client : remaining) {
+        shutdown(client->fd, SHUT_RDWR);
+        if (client->thread.joinable()) {
+            client->thread.join();
+        }
+        close(client->fd);
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return 0;
+}
+
+int runServer(const std::string& socketPath, const std::string& filename) {
+    SheetServer server(socketPath);
+    return server.run(filename);
+}
+
+#endif
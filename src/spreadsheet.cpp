@@ -3,31 +3,180 @@
 #include "display.h"
 #include "matrix.h"
 #include "parser.h"
+#include "watcher.h"
+#include "workbook.h"
+#include <algorithm>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <cctype>
 #include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
 
-static bool isValueTrigger(int ch) {
-    return std::isdigit(ch) || ch == '+' || ch == '-' || ch == '(' || ch == '.' || ch == '#' || ch == '@';
-}
+constexpr int RELOAD_POLL_MS = 100;
+
+struct ReloadState {
+    FileWatcher watcher;
+    std::future<WorkbookImage> loading;
+    FileStamp saved;
+    bool requested = false;
+    bool discard = false;
+};
 
 static bool isLabelTrigger(int ch) {
     return std::isalpha(ch) || ch == '\'';
 }
 
+static void refreshScreen(const SpreadsheetView& view, Matrix& matrix) {
+    matrix.recalculateWindow(view.scrollRow, view.scrollCol, visibleRows(), visibleCols(matrix, view.scrollCol));
+    drawSpreadsheetScreen(view, matrix);
+}
+
+static void scrollToCursorColumn(SpreadsheetView& view, const Matrix& matrix) {
+    if (view.cursorCol < view.scrollCol) {
+        view.scrollCol = view.cursorCol;
+    } else if (view.cursorCol >= view.scrollCol + visibleCols(matrix, view.scrollCol)) {
+        view.scrollCol = matrix.columnLayout.scrollToShow(view.cursorCol, visibleWidth());
+    }
+}
+
+static void scrollToCursor(SpreadsheetView& view, const Matrix& matrix) {
+    if (view.cursorRow < view.scrollRow) {
+        view.scrollRow = view.cursorRow;
+    } else if (view.cursorRow >= view.scrollRow + visibleRows()) {
+        view.scrollRow = view.cursorRow - visibleRows() + 1;
+    }
+    scrollToCursorColumn(view, matrix);
+}
+
+static void findNext(SpreadsheetView& view, const Matrix& matrix) {
+    int row = view.cursorRow;
+    int col = view.cursorCol;
+    if (matrix.findNext(view.lastSearch, row, col)) {
+        view.cursorRow = row;
+        view.cursorCol = col;
+        scrollToCursor(view, matrix);
+    }
+}
+
+static bool runDataTable(Matrix& matrix, const std::string& spec) {
+    std::vector<RangeRef> ranges;
+    size_t start = 0;
+    while (start <= spec.length()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) end = spec.length();
+        RangeRef range;
+        if (!parseRangeAddress(std::string_view(spec).substr(start, end - start), range)) return false;
+        ranges.push_back(range);
+        start = end + 1;
+    }
+    if (ranges.size() == 2) return matrix.dataTable(ranges[0], ranges[1]);
+    if (ranges.size() == 3) return matrix.dataTable(ranges[0], ranges[1], ranges[2]);
+    return false;
+}
+
+static std::string iterationSetting(const Matrix& matrix) {
+    std::ostringstream out;
+    out << matrix.maxIterations << "," << std::setprecision(15) << matrix.iterationTolerance;
+    return out.str();
+}
+
+static void setIteration(Matrix& matrix, const std::string& text) {
+    char* end = nullptr;
+    long limit = std::strtol(text.c_str(), &end, 10);
+    if (end == text.c_str() || *end != ',') return;
+    const char* start = end + 1;
+    double tolerance = std::strtod(start, &end);
+    if (end == start || *end != '\0') return;
+    if (limit < 1 || limit > MAX_ITERATIONS || !(tolerance >= 0.0)) return;
+    matrix.setIteration(static_cast<int>(limit), tolerance);
+}
+
+static std::string memoryReport(const MemoryUsage& usage) {
+    return formatBytes(usage.total()) + " " + formatBytes(usage.bytesPerCell()) + "/cell  cells " + formatBytes(usage.cells) +
+        " text " + formatBytes(usage.text) + " formulas " + formatBytes(usage.formulas) +
+        " indexes " + formatBytes(usage.indexes) + " caches " + formatBytes(usage.caches);
+}
+
+static bool pollReload(Workbook& workbook, ReloadState& reload) {
+    if (reload.watcher.path() != workbook.filename) {
+        reload.watcher.watch(workbook.filename);
+        reload.requested = false;
+    }
+    if (reload.watcher.changed()) {
+        reload.requested = true;
+    }
+    if (reload.requested && !reload.loading.valid()) {
+        std::string fname = workbook.filename;
+        reload.loading = std::async(std::launch::async, [fname, saved = reload.saved] {
+            WorkbookImage image;
+            FileStamp stamp;
+            if (readFileStamp(fname, stamp) && stamp == saved) return image;
+            Workbook::readImage(fname, image);
+            return image;
+        });
+        reload.requested = false;
+    }
+    if (!reload.loading.valid() || reload.loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return false;
+    }
+    WorkbookImage image = reload.loading.get();
+    if (reload.discard) {
+        reload.discard = false;
+        return false;
+    }
+    if (image.filename != workbook.filename) return false;
+    return workbook.applyImage(image) > 0;
+}
+
+static bool saveWorkbook(Workbook& workbook, ReloadState& reload, const std::string& fname) {
+    if (!workbook.saveToFile(fname)) return false;
+    readFileStamp(fname, reload.saved);
+    reload.discard = reload.loading.valid();
+    return true;
+}
+
+static void backgroundRecalc(const SpreadsheetView& view, Matrix& matrix) {
+    if (!matrix.needsRecalc() || matrix.manualRecalc) return;
+
+    drawCalcIndicator(matrix);
+    while (!keyPending()) {
+        if (!matrix.recalcStep(RECALC_BATCH)) {
+            drawSpreadsheetScreen(view, matrix);
+            return;
+        }
+        drawCalcIndicator(matrix);
+    }
+}
+
 void runSpreadsheet() {
     initTerminal();
     hideCursor();
 
     SpreadsheetView view;
-    Matrix matrix;
+    Workbook workbook;
+    ReloadState reload;
 
-    drawSpreadsheetScreen(view, matrix);
+    refreshScreen(view, workbook.activeSheet());
 
     bool running = true;
     while (running) {
+        workbook.trimCache();
+        Matrix& matrix = workbook.activeSheet();
+        backgroundRecalc(view, matrix);
+        while (true) {
+            if (pollReload(workbook, reload)) {
+                refreshScreen(view, workbook.activeSheet());
+                backgroundRecalc(view, workbook.activeSheet());
+            }
+            if (waitForKey(RELOAD_POLL_MS)) break;
+        }
         int key = getKey();
+        if (key == KEY_EOF) break;
 
         if (view.inputType == InputType::DeleteConfirm) {
             if (key == 'Y' || key == 'y') {
@@ -35,101 +184,212 @@ void runSpreadsheet() {
             }
             view.inputType = InputType::None;
             view.inputBuffer.clear();
-            drawSpreadsheetScreen(view, matrix);
+            refreshScreen(view, matrix);
         } else if (view.inputType == InputType::DeleteFilename) {
             if (key == KEY_ESC) {
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             } else if (key == '\r' || key == '\n') {
                 if (!view.inputBuffer.empty()) {
                     std::ifstream file(view.inputBuffer);
                     if (file.good()) {
                         file.close();
                         view.inputType = InputType::DeleteConfirm;
-                        drawSpreadsheetScreen(view, matrix);
+                        refreshScreen(view, matrix);
                         continue;
                     }
                 }
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             } else if (key == 127 || key == 8) {
                 if (!view.inputBuffer.empty()) {
                     view.inputBuffer.pop_back();
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
                 }
             } else if (key >= 32 && key < 127) {
                 view.inputBuffer += static_cast<char>(key);
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             }
         } else if (view.inputType == InputType::LoadFilename) {
             if (key == KEY_ESC) {
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             } else if (key == '\r' || key == '\n') {
                 if (!view.inputBuffer.empty()) {
-                    matrix.loadFromFile(view.inputBuffer);
+                    workbook.loadFromFile(view.inputBuffer);
                 }
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, workbook.activeSheet());
             } else if (key == 127 || key == 8) {
                 if (!view.inputBuffer.empty()) {
                     view.inputBuffer.pop_back();
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
                 }
             } else if (key >= 32 && key < 127) {
                 view.inputBuffer += static_cast<char>(key);
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             }
         } else if (view.inputType == InputType::SaveFilename) {
             if (key == KEY_ESC) {
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
+            } else if (key == '\r' || key == '\n') {
+                if (!view.inputBuffer.empty()) {
+                    saveWorkbook(workbook, reload, view.inputBuffer);
+                }
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+            } else if (key == 127 || key == 8) {
+                if (!view.inputBuffer.empty()) {
+                    view.inputBuffer.pop_back();
+                    refreshScreen(view, matrix);
+                }
+            } else if (key >= 32 && key < 127) {
+                view.inputBuffer += static_cast<char>(key);
+                refreshScreen(view, matrix);
+            }
+        } else if (view.inputType == InputType::SheetName) {
+            if (key == KEY_ESC) {
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
             } else if (key == '\r' || key == '\n') {
                 if (!view.inputBuffer.empty()) {
-                    matrix.saveToFile(view.inputBuffer);
+                    workbook.addSheet(view.inputBuffer);
+                    int index = workbook.findSheet(view.inputBuffer);
+                    if (index >= 0) {
+                        workbook.selectSheet(index);
+                    }
                 }
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, workbook.activeSheet());
             } else if (key == 127 || key == 8) {
                 if (!view.inputBuffer.empty()) {
                     view.inputBuffer.pop_back();
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
                 }
             } else if (key >= 32 && key < 127) {
                 view.inputBuffer += static_cast<char>(key);
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
+            }
+        } else if (view.inputType == InputType::Global) {
+            if (key == 'C' || key == 'c') {
+                view.inputType = InputType::GlobalWidth;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+                continue;
+            } else if (key == 'W' || key == 'w') {
+                view.inputType = InputType::ColumnWidth;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+                continue;
+            } else if (key == 'R' || key == 'r') {
+                view.inputType = InputType::GlobalRecalc;
+                refreshScreen(view, matrix);
+                continue;
+            } else if (key == 'I' || key == 'i') {
+                view.inputType = InputType::GlobalIteration;
+                view.inputBuffer = iterationSetting(matrix);
+                refreshScreen(view, matrix);
+                continue;
+            } else if (key == 'M' || key == 'm') {
+                view.inputType = InputType::MemoryInfo;
+                view.inputBuffer = memoryReport(workbook.memoryUsage());
+                refreshScreen(view, matrix);
+                continue;
+            }
+            view.inputType = InputType::None;
+            refreshScreen(view, matrix);
+        } else if (view.inputType == InputType::MemoryInfo) {
+            view.inputType = InputType::None;
+            view.inputBuffer.clear();
+            refreshScreen(view, matrix);
+        } else if (view.inputType == InputType::GlobalRecalc) {
+            if (key == 'A' || key == 'a') {
+                matrix.manualRecalc = false;
+            } else if (key == 'M' || key == 'm') {
+                matrix.manualRecalc = true;
+            }
+            view.inputType = InputType::None;
+            refreshScreen(view, matrix);
+        } else if (view.inputType == InputType::GlobalIteration) {
+            if (key == KEY_ESC) {
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+            } else if (key == '\r' || key == '\n') {
+                setIteration(matrix, view.inputBuffer);
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+            } else if (key == 127 || key == 8) {
+                if (!view.inputBuffer.empty()) {
+                    view.inputBuffer.pop_back();
+                    refreshScreen(view, matrix);
+                }
+            } else if ((std::isdigit(key) || key == '.' || key == ',' || key == 'e' || key == 'E' || key == '-') && view.inputBuffer.length() < 24) {
+                view.inputBuffer += static_cast<char>(key);
+                refreshScreen(view, matrix);
+            }
+        } else if (view.inputType == InputType::GlobalWidth || view.inputType == InputType::ColumnWidth) {
+            if (key == KEY_ESC) {
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+            } else if (key == '\r' || key == '\n') {
+                if (!view.inputBuffer.empty()) {
+                    int width = std::stoi(view.inputBuffer);
+                    if (view.inputType == InputType::GlobalWidth) {
+                        matrix.columnLayout.setDefaultWidth(width);
+                    } else {
+                        matrix.columnLayout.setWidth(view.cursorCol, width);
+                    }
+                    scrollToCursorColumn(view, matrix);
+                }
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+            } else if (key == 127 || key == 8) {
+                if (!view.inputBuffer.empty()) {
+                    view.inputBuffer.pop_back();
+                    refreshScreen(view, matrix);
+                }
+            } else if (key >= '0' && key <= '9' && view.inputBuffer.length() < 3) {
+                view.inputBuffer += static_cast<char>(key);
+                refreshScreen(view, matrix);
             }
         } else if (view.inputType == InputType::Storage) {
             if (key == 'Q' || key == 'q') {
                 running = false;
             } else if (key == 'S' || key == 's') {
-                if (!matrix.filename.empty()) {
-                    matrix.saveToFile();
+                if (!workbook.filename.empty()) {
+                    saveWorkbook(workbook, reload, workbook.filename);
                 } else {
                     view.inputType = InputType::SaveFilename;
                     view.inputBuffer.clear();
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
                     continue;
                 }
             } else if (key == 'L' || key == 'l') {
                 view.inputType = InputType::LoadFilename;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
                 continue;
             } else if (key == 'D' || key == 'd') {
                 view.inputType = InputType::DeleteFilename;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
                 continue;
             }
             view.inputType = InputType::None;
-            drawSpreadsheetScreen(view, matrix);
+            refreshScreen(view, matrix);
         } else if (view.inputType == InputType::Command) {
             if (key == 'B' || key == 'b') {
                 matrix.clearCell(view.cursorRow, view.cursorCol);
@@ -145,55 +405,103 @@ void runSpreadsheet() {
                         view.inputType = InputType::Label;
                     }
                     view.inputBuffer = cell->getText();
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
                     continue;
                 }
             } else if (key == 'S' || key == 's') {
                 view.inputType = InputType::Storage;
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
+                continue;
+            } else if (key == 'N' || key == 'n') {
+                view.inputType = InputType::SheetName;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+                continue;
+            } else if (key == 'G' || key == 'g') {
+                view.inputType = InputType::Global;
+                refreshScreen(view, matrix);
+                continue;
+            } else if (key == 'X' || key == 'x') {
+                view.inputType = InputType::DataTable;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
                 continue;
             }
             view.inputType = InputType::None;
-            drawSpreadsheetScreen(view, matrix);
+            refreshScreen(view, matrix);
+        } else if (view.inputType == InputType::DataTable) {
+            if (key == KEY_ESC) {
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+            } else if (key == '\r' || key == '\n') {
+                if (!view.inputBuffer.empty()) {
+                    runDataTable(matrix, view.inputBuffer);
+                }
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+            } else if (key == 127 || key == 8) {
+                if (!view.inputBuffer.empty()) {
+                    view.inputBuffer.pop_back();
+                    refreshScreen(view, matrix);
+                }
+            } else if (key >= 32 && key < 127) {
+                view.inputBuffer += static_cast<char>(key);
+                refreshScreen(view, matrix);
+            }
+        } else if (view.inputType == InputType::Find) {
+            if (key == KEY_ESC) {
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+            } else if (key == '\r' || key == '\n') {
+                if (!view.inputBuffer.empty()) {
+                    view.lastSearch = view.inputBuffer;
+                    findNext(view, matrix);
+                }
+                view.inputType = InputType::None;
+                view.inputBuffer.clear();
+                refreshScreen(view, matrix);
+            } else if (key == 127 || key == 8) {
+                if (!view.inputBuffer.empty()) {
+                    view.inputBuffer.pop_back();
+                    refreshScreen(view, matrix);
+                }
+            } else if (key >= 32 && key < 127) {
+                view.inputBuffer += static_cast<char>(key);
+                refreshScreen(view, matrix);
+            }
         } else if (view.inputType == InputType::Goto) {
             if (key == KEY_ESC) {
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             } else if (key == '\r' || key == '\n') {
                 int newRow, newCol;
                 if (parseAddress(view.inputBuffer, newRow, newCol)) {
                     view.cursorRow = newRow;
                     view.cursorCol = newCol;
-                    if (view.cursorRow < view.scrollRow) {
-                        view.scrollRow = view.cursorRow;
-                    } else if (view.cursorRow >= view.scrollRow + visibleRows()) {
-                        view.scrollRow = view.cursorRow - visibleRows() + 1;
-                    }
-                    if (view.cursorCol < view.scrollCol) {
-                        view.scrollCol = view.cursorCol;
-                    } else if (view.cursorCol >= view.scrollCol + visibleCols()) {
-                        view.scrollCol = view.cursorCol - visibleCols() + 1;
-                    }
+                    scrollToCursor(view, matrix);
                 }
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             } else if (key == 127 || key == 8) {
                 if (!view.inputBuffer.empty()) {
                     view.inputBuffer.pop_back();
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
                 }
             } else if (key >= 32 && key < 127) {
                 view.inputBuffer += static_cast<char>(key);
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             }
         } else if (view.mode == EditMode::Editing) {
             if (key == KEY_ESC) {
                 view.mode = EditMode::Normal;
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             } else if (key == '\r' || key == '\n') {
                 if (!view.inputBuffer.empty()) {
                     Cell cell;
@@ -208,15 +516,15 @@ void runSpreadsheet() {
                 view.mode = EditMode::Normal;
                 view.inputType = InputType::None;
                 view.inputBuffer.clear();
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             } else if (key == 127 || key == 8) {
                 if (!view.inputBuffer.empty()) {
                     view.inputBuffer.pop_back();
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
                 }
             } else if (key >= 32 && key < 127) {
                 view.inputBuffer += static_cast<char>(key);
-                drawSpreadsheetScreen(view, matrix);
+                refreshScreen(view, matrix);
             }
         } else {
             switch (key) {
@@ -226,7 +534,7 @@ void runSpreadsheet() {
                         if (view.cursorRow < view.scrollRow) {
                             view.scrollRow = view.cursorRow;
                         }
-                        drawSpreadsheetScreen(view, matrix);
+                        refreshScreen(view, matrix);
                     }
                     break;
 
@@ -236,47 +544,93 @@ void runSpreadsheet() {
                         if (view.cursorRow >= view.scrollRow + visibleRows()) {
                             view.scrollRow = view.cursorRow - visibleRows() + 1;
                         }
-                        drawSpreadsheetScreen(view, matrix);
+                        refreshScreen(view, matrix);
                     }
                     break;
 
                 case KEY_ARROW_LEFT:
                     if (view.cursorCol > 0) {
                         view.cursorCol--;
-                        if (view.cursorCol < view.scrollCol) {
-                            view.scrollCol = view.cursorCol;
-                        }
-                        drawSpreadsheetScreen(view, matrix);
+                        scrollToCursorColumn(view, matrix);
+                        refreshScreen(view, matrix);
                     }
                     break;
 
                 case KEY_ARROW_RIGHT:
                     if (view.cursorCol < MAX_COLS - 1) {
                         view.cursorCol++;
-                        if (view.cursorCol >= view.scrollCol + visibleCols()) {
-                            view.scrollCol = view.cursorCol - visibleCols() + 1;
-                        }
-                        drawSpreadsheetScreen(view, matrix);
+                        scrollToCursorColumn(view, matrix);
+                        refreshScreen(view, matrix);
+                    }
+                    break;
+
+                case KEY_CTRL_F:
+                    view.inputType = InputType::Find;
+                    view.inputBuffer.clear();
+                    refreshScreen(view, matrix);
+                    break;
+
+                case KEY_CTRL_N:
+                    if (!view.lastSearch.empty()) {
+                        findNext(view, matrix);
+                        refreshScreen(view, matrix);
                     }
                     break;
 
                 case '>':
                     view.inputType = InputType::Goto;
                     view.inputBuffer.clear();
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
                     break;
 
                 case '/':
                     view.inputType = InputType::Command;
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
+                    break;
+
+                case '!':
+                    matrix.recalculate();
+                    refreshScreen(view, matrix);
+                    break;
+
+                case ']':
+                    workbook.selectSheet((workbook.activeIndex() + 1) % workbook.sheetCount());
+                    refreshScreen(view, workbook.activeSheet());
+                    break;
+
+                case '[':
+                    workbook.selectSheet((workbook.activeIndex() + workbook.sheetCount() - 1) % workbook.sheetCount());
+                    refreshScreen(view, workbook.activeSheet());
+                    break;
+
+                case KEY_CTRL_UP:
+                case KEY_CTRL_DOWN:
+                    view.cursorRow = matrix.jumpInCol(view.cursorRow, view.cursorCol, key == KEY_CTRL_DOWN ? 1 : -1);
+                    scrollToCursor(view, matrix);
+                    refreshScreen(view, matrix);
+                    break;
+
+                case KEY_CTRL_LEFT:
+                case KEY_CTRL_RIGHT:
+                    view.cursorCol = matrix.jumpInRow(view.cursorRow, view.cursorCol, key == KEY_CTRL_RIGHT ? 1 : -1);
+                    scrollToCursor(view, matrix);
+                    refreshScreen(view, matrix);
+                    break;
+
+                case KEY_END:
+                    view.cursorRow = std::max(matrix.lastUsedRow(), 0);
+                    view.cursorCol = std::max(matrix.lastUsedCol(), 0);
+                    scrollToCursor(view, matrix);
+                    refreshScreen(view, matrix);
                     break;
 
+                case KEY_HOME:
                 case KEY_F1:
                     view.cursorRow = 0;
                     view.cursorCol = 0;
                     view.scrollRow = 0;
                     view.scrollCol = 0;
-                    drawSpreadsheetScreen(view, matrix);
+                    refreshScreen(view, matrix);
                     break;
 
                 case KEY_F2:
@@ -293,7 +647,7 @@ void runSpreadsheet() {
                             if (!view.inputBuffer.empty()) {
                                 view.inputBuffer.pop_back();
                             }
-                            drawSpreadsheetScreen(view, matrix);
+                            refreshScreen(view, matrix);
                         }
                     }
                     break;
@@ -303,12 +657,12 @@ void runSpreadsheet() {
                         view.mode = EditMode::Editing;
                         view.inputType = InputType::Value;
                         view.inputBuffer = std::string(1, static_cast<char>(key));
-                        drawSpreadsheetScreen(view, matrix);
+                        refreshScreen(view, matrix);
                     } else if (isLabelTrigger(key)) {
                         view.mode = EditMode::Editing;
                         view.inputType = InputType::Label;
                         view.inputBuffer = std::string(1, static_cast<char>(key));
-                        drawSpreadsheetScreen(view, matrix);
+                        refreshScreen(view, matrix);
                     }
                     break;
             }
@@ -1,4 +1,90 @@
 #include "terminal.h"
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+static std::string script;
+static size_t scriptPos = 0;
+static size_t scriptKeys = 0;
+static bool scripted = false;
+
+static bool readScriptByte(unsigned char& c) {
+    if (scriptPos >= script.length()) return false;
+    c = static_cast<unsigned char>(script[scriptPos++]);
+    return true;
+}
+
+template <typename Read>
+static int decodeKey(Read read) {
+    unsigned char c;
+    if (!read(c)) return KEY_EOF;
+    if (c != 27) return c;
+
+    unsigned char seq[2];
+    if (!read(seq[0])) return KEY_ESC;
+    if (!read(seq[1])) return KEY_ESC;
+    if (seq[0] == '[') {
+        switch (seq[1]) {
+            case 'A': return KEY_ARROW_UP;
+            case 'B': return KEY_ARROW_DOWN;
+            case 'C': return KEY_ARROW_RIGHT;
+            case 'D': return KEY_ARROW_LEFT;
+            case 'H': return KEY_HOME;
+            case 'F': return KEY_END;
+        }
+        if (seq[1] == '1' || seq[1] == '4') {
+            unsigned char rest[3];
+            if (!read(rest[0])) return KEY_ESC;
+            if (rest[0] == '~') return seq[1] == '1' ? KEY_HOME : KEY_END;
+            if (rest[0] == ';' && read(rest[1]) && read(rest[2]) && rest[1] == '5') {
+                switch (rest[2]) {
+                    case 'A': return KEY_CTRL_UP;
+                    case 'B': return KEY_CTRL_DOWN;
+                    case 'C': return KEY_CTRL_RIGHT;
+                    case 'D': return KEY_CTRL_LEFT;
+                }
+            }
+            return KEY_ESC;
+        }
+        if (seq[1] == '[') {
+            unsigned char fkey;
+            if (read(fkey)) {
+                if (fkey == 'A') return KEY_F1;
+                if (fkey == 'B') return KEY_F2;
+            }
+        }
+    } else if (seq[0] == 'O') {
+        if (seq[1] == 'P') return KEY_F1;
+        if (seq[1] == 'Q') return KEY_F2;
+        if (seq[1] == 'H') return KEY_HOME;
+        if (seq[1] == 'F') return KEY_END;
+    }
+    return KEY_ESC;
+}
+
+bool openKeyScript(const std::string& path) {
+    if (path == "-") {
+        script.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    } else {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) return false;
+        script.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    scriptPos = 0;
+    scriptKeys = 0;
+    scripted = true;
+    return true;
+}
+
+size_t keyScriptKeys() {
+    return scriptKeys;
+}
+
+static int getScriptKey() {
+    int key = decodeKey(readScriptByte);
+    if (key != KEY_EOF) scriptKeys++;
+    return key;
+}
 
 #ifdef _WIN32
 #include <conio.h>
@@ -8,16 +94,19 @@ static DWORD originalMode;
 static HANDLE hStdin;
 
 void initTerminal() {
+    if (scripted) return;
     hStdin = GetStdHandle(STD_INPUT_HANDLE);
     GetConsoleMode(hStdin, &originalMode);
     SetConsoleMode(hStdin, originalMode & ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT));
 }
 
 void restoreTerminal() {
+    if (scripted) return;
     SetConsoleMode(hStdin, originalMode);
 }
 
 int getKey() {
+    if (scripted) return getScriptKey();
     int c = _getch();
     if (c == 0 || c == 224) {
         c = _getch();
@@ -28,18 +117,40 @@ int getKey() {
             case 77: return KEY_ARROW_RIGHT;
             case 59: return KEY_F1;
             case 60: return KEY_F2;
+            case 141: return KEY_CTRL_UP;
+            case 145: return KEY_CTRL_DOWN;
+            case 115: return KEY_CTRL_LEFT;
+            case 116: return KEY_CTRL_RIGHT;
+            case 71: return KEY_HOME;
+            case 79: return KEY_END;
         }
     }
     return c;
 }
 
+bool keyPending() {
+    if (scripted) return scriptPos < script.length();
+    return _kbhit() != 0;
+}
+
+bool waitForKey(int timeoutMs) {
+    if (scripted) return true;
+    for (int waited = 0; !_kbhit(); waited += 10) {
+        if (waited >= timeoutMs) return false;
+        Sleep(10);
+    }
+    return true;
+}
+
 #else
+#include <sys/select.h>
 #include <termios.h>
 #include <unistd.h>
 
 static struct termios originalTermios;
 
 void initTerminal() {
+    if (scripted) return;
     tcgetattr(STDIN_FILENO, &originalTermios);
     struct termios raw = originalTermios;
     raw.c_lflag &= ~(ECHO | ICANON);
@@ -49,39 +160,35 @@ void initTerminal() {
 }
 
 void restoreTerminal() {
+    if (scripted) return;
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &originalTermios);
 }
 
+static bool readTerminalByte(unsigned char& c) {
+    return read(STDIN_FILENO, &c, 1) == 1;
+}
+
 int getKey() {
-    unsigned char c;
-    if (read(STDIN_FILENO, &c, 1) == 1) {
-        if (c == 27) {
-            unsigned char seq[2];
-            if (read(STDIN_FILENO, &seq[0], 1) != 1) return KEY_ESC;
-            if (read(STDIN_FILENO, &seq[1], 1) != 1) return KEY_ESC;
-            if (seq[0] == '[') {
-                switch (seq[1]) {
-                    case 'A': return KEY_ARROW_UP;
-                    case 'B': return KEY_ARROW_DOWN;
-                    case 'C': return KEY_ARROW_RIGHT;
-                    case 'D': return KEY_ARROW_LEFT;
-                }
-                if (seq[1] == '[') {
-                    unsigned char fkey;
-                    if (read(STDIN_FILENO, &fkey, 1) == 1) {
-                        if (fkey == 'A') return KEY_F1;
-                        if (fkey == 'B') return KEY_F2;
-                    }
-                }
-            } else if (seq[0] == 'O') {
-                if (seq[1] == 'P') return KEY_F1;
-                if (seq[1] == 'Q') return KEY_F2;
-            }
-            return KEY_ESC;
-        }
-        return c;
-    }
-    return -1;
+    if (scripted) return getScriptKey();
+    return decodeKey(readTerminalByte);
+}
+
+bool keyPending() {
+    if (scripted) return scriptPos < script.length();
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    struct timeval tv = {0, 0};
+    return select(STDIN_FILENO + 1, &fds, nullptr, nullptr, &tv) > 0;
+}
+
+bool waitForKey(int timeoutMs) {
+    if (scripted) return true;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    struct timeval tv = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    return select(STDIN_FILENO + 1, &fds, nullptr, nullptr, &tv) != 0;
 }
 
 #endif
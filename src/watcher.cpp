@@ -0,0 +1,120 @@
+#include "watcher.h"
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+bool readFileInfo(const std::string& path, FileStamp& stamp) {
+    std::error_code error;
+    auto write = std::filesystem::last_write_time(path, error);
+    if (error) return false;
+    std::uintmax_t size = std::filesystem::file_size(path, error);
+    if (error) return false;
+
+    stamp.lastWrite = write;
+    stamp.size = size;
+    stamp.hash = 0;
+    return true;
+}
+
+bool readFileStamp(const std::string& path, FileStamp& stamp) {
+    std::error_code error;
+    auto write = std::filesystem::last_write_time(path, error);
+    if (error) return false;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+    std::ostringstream data;
+    data << file.rdbuf();
+
+    stamp.lastWrite = write;
+    stamp.size = data.str().size();
+    stamp.hash = std::hash<std::string>{}(data.str());
+    return true;
+}
+
+FileWatcher::~FileWatcher() {
+    stop();
+}
+
+bool FileWatcher::watch(const std::string& path) {
+    stop();
+    watched = path;
+    if (path.empty()) return false;
+
+    std::filesystem::path file(path);
+    name = file.filename().string();
+
+#ifdef __linux__
+    std::string directory = file.has_parent_path() ? file.parent_path().string() : ".";
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return false;
+    wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+#else
+    std::error_code error;
+    existed = std::filesystem::exists(file, error);
+    if (existed) {
+        lastWrite = std::filesystem::last_write_time(file, error);
+        lastSize = std::filesystem::file_size(file, error);
+    }
+#endif
+    return true;
+}
+
+void FileWatcher::stop() {
+#ifdef __linux__
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+    fd = -1;
+    wd = -1;
+    watched.clear();
+    name.clear();
+}
+
+bool FileWatcher::changed() {
+    if (watched.empty()) return false;
+
+#ifdef __linux__
+    if (fd < 0) return false;
+    bool result = false;
+    alignas(struct inotify_event) char buffer[4096];
+    while (true) {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0) break;
+        for (ssize_t pos = 0; pos < length;) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + pos);
+            if (event->len > 0 && name == event->name) {
+                result = true;
+            }
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return result;
+#else
+    std::error_code error;
+    std::filesystem::path file(watched);
+    if (!std::filesystem::exists(file, error)) {
+        existed = false;
+        return false;
+    }
+    auto write = std::filesystem::last_write_time(file, error);
+    std::uintmax_t size = std::filesystem::file_size(file, error);
+    if (error) return false;
+    bool result = !existed || write != lastWrite || size != lastSize;
+    existed = true;
+    lastWrite = write;
+    lastSize = size;
+    return result;
+#endif
+}
@@ -0,0 +1,493 @@
+#include "workbook.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+static std::string normalizeSheetName(const std::string& name) {
+    std::string result = name;
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char ch) { return std::toupper(ch); });
+    return result;
+}
+
+static bool isValidSheetName(const std::string& name) {
+    if (name.empty() || !std::isalpha(static_cast<unsigned char>(name[0]))) return false;
+    for (char ch : name) {
+        if (!std::isalnum(static_cast<unsigned char>(ch)) && ch != '_') return false;
+    }
+    return true;
+}
+
+static void readIndex(std::istream& file, std::vector<WorkbookImage::Sheet>& index, long long& dataStart) {
+    std::string line;
+    if (std::getline(file, line) && line == "#RETROCALC WORKBOOK") {
+        while (std::getline(file, line) && line != "#DATA") {
+            if (line.compare(0, 7, "#SHEET ") != 0) continue;
+            std::istringstream header(line.substr(7));
+            WorkbookImage::Sheet sheet;
+            header >> sheet.offset >> sheet.length >> sheet.name;
+            if (header.fail() || !isValidSheetName(sheet.name)) continue;
+            sheet.name = normalizeSheetName(sheet.name);
+            index.push_back(std::move(sheet));
+        }
+        dataStart = static_cast<long long>(file.tellg());
+    } else {
+        file.clear();
+        file.seekg(0, std::ios::end);
+        WorkbookImage::Sheet sheet;
+        sheet.name = "SHEET1";
+        sheet.length = static_cast<long long>(file.tellg());
+        index.push_back(std::move(sheet));
+        dataStart = 0;
+    }
+}
+
+Workbook::Workbook() {
+    reset();
+}
+
+void Workbook::reset() {
+    sheets.clear();
+    active = 0;
+    loadedCount = 0;
+    sourceFile.clear();
+    sourceStamp = FileStamp();
+    dataStart = 0;
+    useClock = 0;
+    pageFile.reset();
+    pageDead = 0;
+    createSheet("SHEET1");
+}
+
+Workbook::Sheet& Workbook::createSheet(const std::string& name) {
+    Sheet sheet;
+    sheet.name = name;
+    sheet.matrix = std::make_unique<Matrix>();
+    sheet.matrix->sheetName = name;
+    sheet.matrix->workbook = this;
+    sheet.lastUse = ++useClock;
+    sheet.bodyHash = std::hash<std::string>{}(std::string());
+    sheets.push_back(std::move(sheet));
+    loadedCount++;
+    return sheets.back();
+}
+
+Matrix& Workbook::ensureLoaded(Sheet& sheet) {
+    sheet.lastUse = ++useClock;
+    if (sheet.loaded) return *sheet.matrix;
+
+    std::string data;
+    bool read = readSheetData(sheet, data);
+    std::string base;
+    bool hasBase = sheet.paged && readPage(sheet.offset + sheet.length, sheet.baseLength, base);
+
+    sheet.loaded = true;
+    sheet.stale = false;
+    sheet.watched.clear();
+    loadedCount++;
+
+    if (read) {
+        std::istringstream in(data);
+        sheet.matrix->loadFromStream(in);
+    }
+    if (hasBase) {
+        sheet.matrix->restoreSavedBase(base);
+    }
+    sheet.bodyHash = std::hash<std::string>{}(data);
+    return *sheet.matrix;
+}
+
+bool Workbook::readSheetData(const Sheet& sheet, std::string& data) {
+    if (sheet.paged) return readPage(sheet.offset, sheet.length, data);
+    if (sourceFile.empty() || sheet.length <= 0 || !refreshSource()) return false;
+    if (sheet.length <= 0) return false;
+
+    std::ifstream file(sourceFile, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    file.seekg(dataStart + sheet.offset);
+    data.resize(static_cast<size_t>(sheet.length));
+    file.read(&data[0], sheet.length);
+    data.resize(static_cast<size_t>(file.gcount()));
+    return true;
+}
+
+bool Workbook::refreshSource() {
+    FileStamp stamp;
+    if (!readFileInfo(sourceFile, stamp)) return false;
+    if (stamp == sourceStamp) return true;
+
+    std::ifstream file(sourceFile, std::ios::binary);
+    if (!file.is_open()) return false;
+    std::vector<WorkbookImage::Sheet> index;
+    readIndex(file, index, dataStart);
+    sourceStamp = stamp;
+    reindex(index);
+    return true;
+}
+
+void Workbook::reindex(const std::vector<WorkbookImage::Sheet>& index) {
+    for (Sheet& sheet : sheets) {
+        if (sheet.paged) continue;
+        if (sheet.loaded) {
+            sheet.bodyHash = 0;
+            continue;
+        }
+        sheet.offset = 0;
+        sheet.length = 0;
+        for (const WorkbookImage::Sheet& entry : index) {
+            if (entry.name != sheet.name) continue;
+            sheet.offset = entry.offset;
+            sheet.length = entry.length;
+            break;
+        }
+    }
+}
+
+bool Workbook::readPage(long long offset, long long length, std::string& data) const {
+    if (!pageFile || std::fseek(pageFile.get(), static_cast<long>(offset), SEEK_SET) != 0) return false;
+    data.resize(static_cast<size_t>(length));
+    data.resize(std::fread(&data[0], 1, data.size(), pageFile.get()));
+    return true;
+}
+
+Matrix& Workbook::activeSheet() {
+    return ensureLoaded(sheets[active]);
+}
+
+Matrix& Workbook::sheetAt(size_t index) {
+    return ensureLoaded(sheets[index]);
+}
+
+Matrix* Workbook::sheet(const std::string& name) {
+    int index = findSheet(name);
+    if (index < 0) return nullptr;
+    return &ensureLoaded(sheets[index]);
+}
+
+int Workbook::findSheet(const std::string& name) const {
+    std::string key = normalizeSheetName(name);
+    for (size_t i = 0; i < sheets.size(); i++) {
+        if (sheets[i].name == key) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+bool Workbook::addSheet(const std::string& name) {
+    if (!isValidSheetName(name) || findSheet(name) >= 0) return false;
+    createSheet(normalizeSheetName(name));
+    return true;
+}
+
+void Workbook::selectSheet(size_t index) {
+    if (index < sheets.size()) {
+        active = index;
+    }
+}
+
+bool Workbook::saveToFile(const std::string& fname) {
+    if (fname.empty()) return false;
+
+    std::vector<std::string> bodies(sheets.size());
+    for (size_t i = 0; i < sheets.size(); i++) {
+        if (sheets[i].loaded) {
+            std::ostringstream out;
+            sheets[i].matrix->saveToStream(out);
+            bodies[i] = out.str();
+        } else if (!readSheetData(sheets[i], bodies[i]) && sheets[i].length > 0) {
+            return false;
+        }
+    }
+
+    std::ofstream file(fname, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    file << "#RETROCALC WORKBOOK\n";
+    long long offset = 0;
+    for (size_t i = 0; i < sheets.size(); i++) {
+        file << "#SHEET " << offset << " " << bodies[i].size() << " " << sheets[i].name << "\n";
+        offset += static_cast<long long>(bodies[i].size());
+    }
+    file << "#DATA\n";
+    long long start = static_cast<long long>(file.tellp());
+
+    for (size_t i = 0; i < sheets.size(); i++) {
+        file << bodies[i];
+    }
+    if (!file) return false;
+
+    offset = 0;
+    for (size_t i = 0; i < sheets.size(); i++) {
+        sheets[i].offset = offset;
+        sheets[i].length = static_cast<long long>(bodies[i].size());
+        sheets[i].paged = false;
+        sheets[i].bodyHash = std::hash<std::string>{}(bodies[i]);
+        if (sheets[i].loaded) sheets[i].matrix->markSaved(bodies[i]);
+        offset += sheets[i].length;
+    }
+    pageFile.reset();
+    pageDead = 0;
+
+    file.close();
+    dataStart = start;
+    sourceFile = fname;
+    readFileInfo(fname, sourceStamp);
+    filename = fname;
+    return true;
+}
+
+bool Workbook::saveToFile() {
+    return saveToFile(filename);
+}
+
+bool Workbook::loadFromFile(const std::string& fname) {
+    if (fname.empty()) return false;
+
+    reset();
+
+    std::ifstream file(fname, std::ios::binary);
+    if (!file.is_open()) {
+        filename = fname;
+        return false;
+    }
+
+    readFileInfo(fname, sourceStamp);
+    std::vector<WorkbookImage::Sheet> index;
+    readIndex(file, index, dataStart);
+    sheets.clear();
+    loadedCount = 0;
+    for (const WorkbookImage::Sheet& entry : index) {
+        if (findSheet(entry.name) >= 0) continue;
+        Sheet& sheet = createSheet(entry.name);
+        sheet.offset = entry.offset;
+        sheet.length = entry.length;
+        sheet.loaded = false;
+        loadedCount--;
+    }
+    if (sheets.empty()) {
+        createSheet("SHEET1");
+    }
+
+    sourceFile = fname;
+    filename = fname;
+    return true;
+}
+
+void Workbook::markSheetDirty(const Matrix& source) {
+    for (Sheet& sheet : sheets) {
+        if (sheet.matrix.get() == &source) continue;
+        if (sheet.loaded) {
+            sheet.matrix->markExternalSheetDirty(source.sheetName);
+        } else if (sheet.watched.count(source.sheetName)) {
+            markEvictedDirty(sheet);
+        }
+    }
+}
+
+void Workbook::markEvictedDirty(Sheet& evicted) {
+    if (evicted.stale) return;
+    evicted.stale = true;
+    for (Sheet& sheet : sheets) {
+        if (&sheet == &evicted) continue;
+        if (sheet.loaded) {
+            sheet.matrix->markExternalSheetDirty(evicted.name);
+        } else if (sheet.watched.count(evicted.name)) {
+            markEvictedDirty(sheet);
+        }
+    }
+}
+
+MemoryUsage Workbook::memoryUsage() const {
+    MemoryUsage usage;
+    for (const Sheet& sheet : sheets) {
+        if (sheet.loaded) usage += sheet.matrix->memoryUsage();
+        usage.caches += hashBytes(sheet.watched);
+        for (const auto& watched : sheet.watched) usage.caches += hashBytes(watched.second);
+    }
+    return usage;
+}
+
+bool Workbook::readImage(const std::string& fname, WorkbookImage& image) {
+    image = WorkbookImage();
+    image.filename = fname;
+
+    if (!readFileInfo(fname, image.stamp)) return false;
+    std::ifstream file(fname, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    readIndex(file, image.sheets, image.dataStart);
+
+    std::string data;
+    for (WorkbookImage::Sheet& sheet : image.sheets) {
+        data.clear();
+        if (sheet.length > 0) {
+            file.clear();
+            file.seekg(image.dataStart + sheet.offset);
+            data.resize(static_cast<size_t>(sheet.length));
+            file.read(&data[0], sheet.length);
+            data.resize(static_cast<size_t>(file.gcount()));
+        }
+        sheet.hash = std::hash<std::string>{}(data);
+        std::istringstream in(data);
+        if (!readSheetImage(in, sheet.image)) return false;
+    }
+    image.ok = true;
+    return true;
+}
+
+size_t Workbook::applyImage(const WorkbookImage& image) {
+    if (!image.ok) return 0;
+
+    reindex(image.sheets);
+    size_t changed = 0;
+    for (const WorkbookImage::Sheet& source : image.sheets) {
+        int index = findSheet(source.name);
+        if (index < 0) {
+            createSheet(source.name);
+            index = static_cast<int>(sheets.size()) - 1;
+        }
+        Sheet& sheet = sheets[index];
+        if (sheet.paged) {
+            ensureLoaded(sheet);
+            releasePage(sheet);
+        }
+        sheet.offset = source.offset;
+        sheet.length = source.length;
+        sheet.bodyHash = source.hash;
+        if (sheet.loaded) {
+            changed += sheet.matrix->mergeImage(source.image);
+        }
+    }
+    dataStart = image.dataStart;
+    sourceFile = image.filename;
+    sourceStamp = image.stamp;
+    return changed;
+}
+
+void Workbook::markReferencesDirty(const Matrix& source, int key) {
+    if (sheets.size() < 2) return;
+
+    for (Sheet& sheet : sheets) {
+        if (sheet.matrix.get() == &source) continue;
+        if (sheet.loaded) {
+            sheet.matrix->markExternalDirty(source.sheetName, key);
+            continue;
+        }
+        auto watched = sheet.watched.find(source.sheetName);
+        if (watched != sheet.watched.end() && watched->second.count(key)) {
+            markEvictedDirty(sheet);
+        }
+    }
+}
+
+size_t Workbook::trimCache() {
+    size_t evicted = 0;
+    while (sheetCacheLimit > 0 && loadedCount > sheetCacheLimit) {
+        Sheet* oldest = nullptr;
+        for (size_t i = 0; i < sheets.size(); i++) {
+            if (!sheets[i].loaded || i == active) continue;
+            if (!oldest || sheets[i].lastUse < oldest->lastUse) oldest = &sheets[i];
+        }
+        if (!oldest) break;
+
+        evictSheet(*oldest);
+        if (oldest->loaded) break;
+        evicted++;
+    }
+    return evicted;
+}
+
+void Workbook::evictSheet(Sheet& sheet) {
+    if (!sheet.paged && !sourceFile.empty() && !refreshSource()) {
+        sheet.bodyHash = 0;
+    }
+    std::ostringstream out;
+    sheet.matrix->saveToStream(out);
+    std::string data = out.str();
+    size_t hash = std::hash<std::string>{}(data);
+    if (hash != sheet.bodyHash && !writePage(sheet, data)) return;
+
+    sheet.bodyHash = hash;
+    sheet.watched.clear();
+    for (const auto& ext : sheet.matrix->graph->externalDependents) {
+        std::unordered_set<int>& keys = sheet.watched[std::string(ext.first)];
+        for (const auto& dep : ext.second) {
+            keys.insert(dep.first);
+        }
+    }
+    sheet.stale = false;
+    sheet.matrix = std::make_unique<Matrix>();
+    sheet.matrix->sheetName = sheet.name;
+    sheet.matrix->workbook = this;
+    sheet.loaded = false;
+    loadedCount--;
+}
+
+bool Workbook::writePage(Sheet& sheet, const std::string& data) {
+    std::string record = data + sheet.matrix->savedBase();
+    long long size = static_cast<long long>(record.size());
+
+    if (sheet.paged && size <= sheet.pageSlot) {
+        if (std::fseek(pageFile.get(), static_cast<long>(sheet.offset), SEEK_SET) != 0 ||
+            std::fwrite(record.data(), 1, record.size(), pageFile.get()) != record.size()) {
+            releasePage(sheet);
+            return false;
+        }
+    } else {
+        if (pageDead > PAGE_COMPACT_BYTES && pageDead > pageFileSize() - pageDead) compactPages();
+        if (!pageFile) pageFile.reset(std::tmpfile());
+        if (!pageFile || std::fseek(pageFile.get(), 0, SEEK_END) != 0) return false;
+
+        long offset = std::ftell(pageFile.get());
+        if (offset < 0 || std::fwrite(record.data(), 1, record.size(), pageFile.get()) != record.size()) return false;
+
+        releasePage(sheet);
+        sheet.offset = offset;
+        sheet.pageSlot = size;
+    }
+    sheet.length = static_cast<long long>(data.size());
+    sheet.baseLength = size - sheet.length;
+    sheet.paged = true;
+    return true;
+}
+
+void Workbook::releasePage(Sheet& sheet) {
+    if (!sheet.paged) return;
+    pageDead += sheet.pageSlot;
+    sheet.paged = false;
+    sheet.pageSlot = 0;
+    sheet.bodyHash = 0;
+}
+
+bool Workbook::compactPages() {
+    std::unique_ptr<std::FILE, FileCloser> compacted(std::tmpfile());
+    if (!compacted) return false;
+
+    std::vector<long long> offsets(sheets.size(), 0);
+    long long offset = 0;
+    std::string record;
+    for (size_t i = 0; i < sheets.size(); i++) {
+        const Sheet& sheet = sheets[i];
+        if (!sheet.paged) continue;
+        long long size = sheet.length + sheet.baseLength;
+        if (!readPage(sheet.offset, size, record) || static_cast<long long>(record.size()) != size) return false;
+        if (std::fwrite(record.data(), 1, record.size(), compacted.get()) != record.size()) return false;
+        offsets[i] = offset;
+        offset += size;
+    }
+
+    for (size_t i = 0; i < sheets.size(); i++) {
+        if (!sheets[i].paged) continue;
+        sheets[i].offset = offsets[i];
+        sheets[i].pageSlot = sheets[i].length + sheets[i].baseLength;
+    }
+    pageFile = std::move(compacted);
+    pageDead = 0;
+    return true;
+}
+
+long long Workbook::pageFileSize() const {
+    if (!pageFile || std::fseek(pageFile.get(), 0, SEEK_END) != 0) return 0;
+    return std::ftell(pageFile.get());
+}
@@ -0,0 +1,66 @@
+#include "workbook.h"
+#include <cstdio>
+#include <string>
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& message) {
+    if (!condition) {
+        std::fprintf(stderr, "FAIL: %s\n", message.c_str());
+        failures++;
+    }
+}
+
+static void setValue(Matrix& matrix, int row, int col, const std::string& text) {
+    Cell cell;
+    cell.setValue(text, 0.0);
+    matrix.setCell(row, col, cell);
+}
+
+static double valueAt(const Matrix& matrix, int row, int col) {
+    const Cell* cell = matrix.getCellPtr(row, col);
+    return cell ? cell->numericValue : 0.0;
+}
+
+static void testCrossSheetTable() {
+    const int inputs = 32;
+    Workbook workbook;
+    workbook.addSheet("S2");
+    Matrix& model = workbook.sheetAt(0);
+    Matrix& other = workbook.sheetAt(1);
+
+    setValue(other, 0, 0, "1");
+    setValue(other, 1, 0, "2");
+    setValue(other, 2, 0, "3");
+    setValue(other, 0, 1, "+A1*10");
+    setValue(other, 0, 2, "@SUM(A1...A3)");
+    other.recalculate();
+
+    setValue(model, 0, 0, "0");
+    setValue(model, 1, 0, "+A1+S2!B1+@SUM(S2!A1...A3)");
+    setValue(model, 4, 0, "+A1*2");
+    setValue(model, 5, 0, "1");
+    setValue(model, 2, 0, "+A2+@SUM(A5...A6)");
+    setValue(model, 0, 2, "+A3");
+    for (int i = 1; i <= inputs; i++) {
+        setValue(model, i, 1, std::to_string(i));
+    }
+    model.recalculate();
+
+    other.manualRecalc = true;
+    setValue(other, 0, 0, "4");
+
+    model.tableWorkers = 4;
+    RangeRef table{"", 0, 1, inputs, 2};
+    RangeRef input{"", 0, 0, 0, 0};
+    check(model.dataTable(table, input), "data table runs");
+    for (int i = 1; i <= inputs; i++) {
+        check(valueAt(model, i, 2) == 3.0 * i + 50.0, "row " + std::to_string(i) + " reads current cross-sheet values and sums");
+    }
+    check(valueAt(other, 0, 1) == 40.0, "referenced sheet is recalculated before the workers start");
+}
+
+int main() {
+    testCrossSheetTable();
+    return failures == 0 ? 0 : 1;
+}
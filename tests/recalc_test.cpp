@@ -0,0 +1,78 @@
+#include "matrix.h"
+#include <cstdio>
+#include <string>
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& message) {
+    if (!condition) {
+        std::fprintf(stderr, "FAIL: %s\n", message.c_str());
+        failures++;
+    }
+}
+
+static void setValue(Matrix& matrix, int row, int col, const std::string& text) {
+    Cell cell;
+    cell.setValue(text, 0.0);
+    matrix.setCell(row, col, cell);
+}
+
+static double valueAt(const Matrix& matrix, int row, int col) {
+    const Cell* cell = matrix.getCellPtr(row, col);
+    return cell ? cell->numericValue : 0.0;
+}
+
+static void testLargeSumIsOneEdge() {
+    const int rows = 255;
+    const int cols = 62;
+    Matrix matrix;
+    double expected = 0.0;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            setValue(matrix, r, c, std::to_string(r + c));
+            expected += r + c;
+        }
+    }
+    setValue(matrix, rows, 0, "@SUM(A1...BJ255)");
+    setValue(matrix, rows, 1, "+A256*2");
+    matrix.recalculate();
+    check(valueAt(matrix, rows, 0) == expected, "large sum evaluates");
+    check(matrix.memoryUsage().formulas < 64 * 1024, "a range is stored as one graph edge, not one per cell");
+
+    unsigned seed = 7;
+    for (int i = 0; i < 500; i++) {
+        seed = seed * 1103515245 + 12345;
+        int r = static_cast<int>(seed >> 8) % rows;
+        int c = static_cast<int>(seed >> 16) % cols;
+        expected += i - valueAt(matrix, r, c);
+        setValue(matrix, r, c, std::to_string(i));
+        matrix.recalculate();
+    }
+    check(valueAt(matrix, rows, 0) == expected, "incremental sum matches the cells after many edits");
+    check(valueAt(matrix, rows, 1) == expected * 2, "dependents of the sum follow it");
+}
+
+static void testRangeDependencies() {
+    Matrix matrix;
+    for (int r = 0; r < 5; r++) {
+        setValue(matrix, r, 1, "+A" + std::to_string(r + 1) + "*2");
+    }
+    setValue(matrix, 5, 1, "@SUM(B1...B5)");
+    setValue(matrix, 0, 0, "1");
+    matrix.recalculate();
+    check(valueAt(matrix, 5, 1) == 2.0, "sum waits for the formulas in its range");
+
+    setValue(matrix, 2, 0, "10");
+    matrix.recalculate();
+    check(valueAt(matrix, 5, 1) == 22.0, "edit reaches the sum through a formula in its range");
+
+    setValue(matrix, 6, 0, "@SUM(A1...A7)");
+    matrix.recalculate();
+    check(matrix.needsRecalc() == false, "range that contains its own formula is solved as a cycle");
+}
+
+int main() {
+    testLargeSumIsOneEdge();
+    testRangeDependencies();
+    return failures == 0 ? 0 : 1;
+}
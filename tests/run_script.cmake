@@ -0,0 +1,23 @@
+file(REMOVE_RECURSE ${WORKDIR})
+file(MAKE_DIRECTORY ${WORKDIR})
+execute_process(
+    COMMAND ${RETROCALC} --script ${SCRIPT} --render buffer --size 80x24
+    WORKING_DIRECTORY ${WORKDIR}
+    OUTPUT_VARIABLE actual
+    ERROR_VARIABLE timing
+    RESULT_VARIABLE result)
+file(REMOVE_RECURSE ${WORKDIR})
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${SCRIPT} exited with ${result}")
+endif()
+message(STATUS "${timing}")
+
+if(UPDATE)
+    file(WRITE ${EXPECTED} "${actual}")
+    return()
+endif()
+
+file(READ ${EXPECTED} expected)
+if(NOT actual STREQUAL expected)
+    message(FATAL_ERROR "Screen differs from ${EXPECTED}:\n${actual}")
+endif()
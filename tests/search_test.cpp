@@ -0,0 +1,52 @@
+#include "search.h"
+#include "cell.h"
+#include <cstdio>
+#include <string>
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& message) {
+    if (!condition) {
+        std::fprintf(stderr, "FAIL: %s\n", message.c_str());
+        failures++;
+    }
+}
+
+static int key(int row, int col) {
+    return row * MAX_COLS + col;
+}
+
+static void testLabelMatches() {
+    SearchIndex index;
+    index.addLabel(key(0, 0), "abc bcd");
+    index.addLabel(key(3, 1), "Quarterly ABCD");
+    index.addLabel(key(5, 0), "x");
+    index.addValue(key(2, 2), 42.0);
+
+    int result = -1;
+    check(index.findNext("abcd", key(0, 0), false, result) && result == key(3, 1), "trigram candidates are checked for the whole query");
+    check(index.findNext("abcd", key(3, 1), false, result) && result == key(3, 1), "search wraps to the only match");
+    check(index.findNext("x", key(0, 0), false, result) && result == key(5, 0), "one-letter query finds a short label");
+    check(index.findNext("bc", key(0, 0), true, result) && result == key(3, 1), "two-letter query follows column order");
+    check(index.findNext("42", key(0, 0), false, result) && result == key(2, 2), "number query finds the value");
+    check(!index.findNext("nan", key(0, 0), false, result), "nan is not a number query");
+
+    index.removeLabel(key(3, 1));
+    check(index.findNext("abcd", key(0, 0), false, result) == false, "removed label is not found");
+    check(index.findNext("bcd", key(0, 0), false, result) && result == key(0, 0), "remaining label is still found");
+}
+
+static void testIndexSize() {
+    const int labels = 2000;
+    SearchIndex index;
+    for (int i = 0; i < labels; i++) {
+        index.addLabel(i, "invoice " + std::to_string(i) + " north region quarterly total");
+    }
+    check(index.memoryUsage() / labels < 1024, "a 40-character label costs less than 1 KB of index");
+}
+
+int main() {
+    testLabelMatches();
+    testIndexSize();
+    return failures == 0 ? 0 : 1;
+}
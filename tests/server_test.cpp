@@ -0,0 +1,129 @@
+#include "server.h"
+#include <cstdio>
+#include <string>
+
+#ifdef _WIN32
+
+int main() {
+    return 0;
+}
+
+#else
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char* SOCKET_FILE = "retrocalc_server_test.sock";
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& message) {
+    if (!condition) {
+        std::fprintf(stderr, "FAIL: %s\n", message.c_str());
+        failures++;
+    }
+}
+
+struct Connection {
+    int fd = -1;
+    std::string buffer;
+};
+
+static bool connectClient(Connection& connection) {
+    for (int attempt = 0; attempt < 500; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, SOCKET_FILE, sizeof(addr.sun_path) - 1);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            timeval timeout{10, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            connection.fd = fd;
+            return true;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+static void sendLine(Connection& connection, const std::string& line) {
+    std::string data = line + "\n";
+    send(connection.fd, data.data(), data.length(), MSG_NOSIGNAL);
+}
+
+static bool readLine(Connection& connection, std::string& line) {
+    size_t newline;
+    while ((newline = connection.buffer.find('\n')) == std::string::npos) {
+        char data[65536];
+        ssize_t n = recv(connection.fd, data, sizeof(data), 0);
+        if (n <= 0) return false;
+        connection.buffer.append(data, static_cast<size_t>(n));
+    }
+    line = connection.buffer.substr(0, newline);
+    connection.buffer.erase(0, newline + 1);
+    return true;
+}
+
+static std::string request(Connection& connection, const std::string& line) {
+    sendLine(connection, line);
+    std::string reply;
+    return readLine(connection, reply) ? reply : std::string();
+}
+
+static void testWriteIsVisibleToOtherClients(Connection& writer, Connection& reader) {
+    check(request(writer, "SET B2 42").compare(0, 3, "OK ") == 0, "write is accepted");
+    check(request(reader, "GET B2") == "OK B2 V 42 42", "second client reads the write");
+    check(request(writer, "SET C2 +B2*2").compare(0, 3, "OK ") == 0, "formula is accepted");
+    check(request(reader, "GET C2") == "OK C2 V 84 +B2*2", "second client reads the recalculated formula");
+}
+
+static void testSlowSubscriberIsResynced(Connection& writer, Connection& slow) {
+    check(request(slow, "SUBSCRIBE") == "OK", "client subscribes");
+
+    size_t events = 0;
+    for (int i = 0; events < 4 * CLIENT_OUTBOX_LIMIT; i++) {
+        check(request(writer, "SET A1...BL256 " + std::to_string(i)).compare(0, 3, "OK ") == 0, "bulk write is accepted");
+        events += 16384 * 24;
+    }
+
+    std::string line;
+    bool resync = false;
+    while (!resync && readLine(slow, line)) {
+        resync = line.compare(0, 7, "RESYNC ") == 0;
+    }
+    check(resync, "client over its outbox limit receives RESYNC");
+}
+
+int main() {
+    int status = -1;
+    std::thread server([&status] { status = runServer(SOCKET_FILE, ""); });
+
+    Connection writer;
+    Connection reader;
+    Connection slow;
+    bool connected = connectClient(writer) && connectClient(reader) && connectClient(slow);
+    check(connected, "clients connect");
+    if (connected) {
+        testWriteIsVisibleToOtherClients(writer, reader);
+        testSlowSubscriberIsResynced(writer, slow);
+    }
+
+    close(slow.fd);
+    close(reader.fd);
+    if (writer.fd >= 0) {
+        check(request(writer, "SHUTDOWN") == "OK", "server shuts down");
+        close(writer.fd);
+    }
+    server.join();
+    check(status == 0, "server exits cleanly");
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
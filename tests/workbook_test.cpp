@@ -0,0 +1,240 @@
+#include "workbook.h"
+#include <cstdio>
+#include <string>
+
+static const char* TEST_FILE = "retrocalc_workbook_test.tmp";
+static const char* COPY_FILE = "retrocalc_workbook_copy.tmp";
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& message) {
+    if (!condition) {
+        std::fprintf(stderr, "FAIL: %s\n", message.c_str());
+        failures++;
+    }
+}
+
+static void setValue(Matrix& matrix, int row, int col, const std::string& text) {
+    Cell cell;
+    cell.setValue(text, 0.0);
+    matrix.setCell(row, col, cell);
+}
+
+static void setLabel(Matrix& matrix, int row, int col, const std::string& text) {
+    Cell cell;
+    cell.setLabel(text);
+    matrix.setCell(row, col, cell);
+}
+
+static std::string cellText(const Matrix& matrix, int row, int col) {
+    const Cell* cell = matrix.getCellPtr(row, col);
+    return cell ? std::string(cell->text) : std::string();
+}
+
+static void changeExternally(int row, int col, const std::string& text, size_t sheet = 0) {
+    Workbook other;
+    other.loadFromFile(TEST_FILE);
+    setValue(other.sheetAt(sheet), row, col, text);
+    other.saveToFile(TEST_FILE);
+}
+
+static size_t reload(Workbook& workbook) {
+    WorkbookImage image;
+    Workbook::readImage(TEST_FILE, image);
+    return workbook.applyImage(image);
+}
+
+static void testMergeKeepsLocalEdits() {
+    Workbook workbook;
+    Matrix& matrix = workbook.activeSheet();
+    setValue(matrix, 0, 0, "1");
+    setValue(matrix, 6, 1, "2");
+    workbook.saveToFile(TEST_FILE);
+
+    setValue(matrix, 6, 1, "5");
+    setValue(matrix, 9, 9, "7");
+    changeExternally(0, 0, "100");
+
+    check(reload(workbook) == 1, "reload merges only the externally changed cell");
+    check(cellText(matrix, 0, 0) == "100", "external change to A1 is applied");
+    check(cellText(matrix, 6, 1) == "5", "local edit to B7 is kept");
+    check(cellText(matrix, 9, 9) == "7", "new local cell J10 is kept");
+
+    changeExternally(6, 1, "9");
+    reload(workbook);
+    check(cellText(matrix, 6, 1) == "9", "external change wins over a local edit of the same cell");
+}
+
+static void testMergeAppliesExternalClears() {
+    Workbook workbook;
+    Matrix& matrix = workbook.activeSheet();
+    setValue(matrix, 0, 0, "1");
+    setValue(matrix, 1, 0, "2");
+    setValue(matrix, 2, 0, "3");
+    workbook.saveToFile(TEST_FILE);
+
+    Workbook other;
+    other.loadFromFile(TEST_FILE);
+    other.sheetAt(0).clearCell(0, 0);
+    other.saveToFile(TEST_FILE);
+    matrix.clearCell(1, 0);
+
+    reload(workbook);
+    check(!matrix.hasCell(0, 0), "external clear is applied");
+    check(!matrix.hasCell(1, 0), "local clear of an unchanged cell is kept");
+    check(cellText(matrix, 2, 0) == "3", "untouched cell is kept");
+}
+
+static void testMergeBaseIsCompact() {
+    const int rows = 128;
+    const int cols = 32;
+    Workbook workbook;
+    Matrix& matrix = workbook.activeSheet();
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            setLabel(matrix, r, c, "quarterly report line " + std::to_string(r * cols + c));
+        }
+    }
+    workbook.saveToFile(TEST_FILE);
+
+    Workbook loaded;
+    loaded.loadFromFile(TEST_FILE);
+    MemoryUsage usage = loaded.sheetAt(0).memoryUsage();
+    check(usage.caches / usage.cellCount < 128, "merge base keeps a hash per cell, not a copy");
+}
+
+static void testMergeBaseSurvivesEviction() {
+    Workbook workbook;
+    workbook.addSheet("S2");
+    setValue(workbook.sheetAt(0), 0, 0, "1");
+    setValue(workbook.sheetAt(0), 6, 1, "2");
+    workbook.saveToFile(TEST_FILE);
+
+    setValue(workbook.sheetAt(0), 6, 1, "5");
+    workbook.selectSheet(1);
+    workbook.sheetCacheLimit = 1;
+    workbook.trimCache();
+    check(workbook.isPaged(0), "edited sheet is paged out");
+    changeExternally(0, 0, "100");
+
+    reload(workbook);
+    check(cellText(workbook.sheetAt(0), 0, 0) == "100", "external change reaches a paged sheet");
+    check(cellText(workbook.sheetAt(0), 6, 1) == "5", "local edit on a paged sheet is kept");
+}
+
+static void testEvictedSheetPropagatesChanges() {
+    Workbook workbook;
+    workbook.addSheet("S2");
+    Matrix& model = workbook.sheetAt(0);
+    setValue(model, 0, 0, "1");
+    setValue(model, 2, 0, "+S2!B1");
+    setValue(workbook.sheetAt(1), 0, 1, "+SHEET1!A1*2");
+    model.recalculate();
+    check(model.getCellPtr(2, 0)->numericValue == 2.0, "cross-sheet chain evaluates");
+
+    workbook.sheetCacheLimit = 1;
+    workbook.trimCache();
+    check(!workbook.isLoaded(1), "S2 is evicted");
+
+    setValue(model, 0, 0, "50");
+    model.recalculate();
+    check(model.getCellPtr(2, 0)->numericValue == 100.0, "edit reaches A3 through the evicted sheet");
+}
+
+static void testPageFileStaysCompact() {
+    const int rounds = 40;
+    const std::string text(4000, 'x');
+    Workbook workbook;
+    workbook.addSheet("S2");
+    workbook.sheetCacheLimit = 1;
+    for (int i = 0; i < rounds; i++) {
+        Cell cell;
+        cell.setLabel(text);
+        workbook.sheetAt(1).setCell(i, 0, cell);
+        workbook.trimCache();
+    }
+    check(workbook.isPaged(1), "growing sheet is paged");
+    long long live = static_cast<long long>(rounds) * static_cast<long long>(text.size() + 16);
+    check(workbook.pageFileSize() < 3 * live, "page file is compacted once dead space passes the live pages");
+
+    long long size = workbook.pageFileSize();
+    workbook.sheetAt(1).clearCell(0, 0);
+    workbook.trimCache();
+    check(workbook.pageFileSize() == size, "a smaller page reuses its slot");
+    check(cellText(workbook.sheetAt(1), 1, 0) == text, "paged sheet reads back");
+    check(!workbook.sheetAt(1).hasCell(0, 0), "rewritten page reads back");
+}
+
+static void testCleanSheetsAreNotPaged() {
+    Workbook workbook;
+    workbook.addSheet("S2");
+    workbook.sheetCacheLimit = 1;
+    workbook.trimCache();
+    check(!workbook.isLoaded(1) && !workbook.isPaged(1), "new empty sheet is dropped without paging");
+
+    setValue(workbook.sheetAt(1), 0, 0, "1");
+    workbook.saveToFile(TEST_FILE);
+    changeExternally(0, 0, "2");
+    reload(workbook);
+    workbook.selectSheet(1);
+    workbook.sheetAt(1);
+    workbook.trimCache();
+    check(!workbook.isLoaded(0) && !workbook.isPaged(0), "reloaded sheet without local edits is dropped without paging");
+}
+
+static void writeTwoSheets() {
+    Workbook workbook;
+    workbook.addSheet("S2");
+    setValue(workbook.sheetAt(0), 0, 0, "1");
+    setLabel(workbook.sheetAt(1), 0, 0, "hello");
+    setValue(workbook.sheetAt(1), 1, 0, "42");
+    workbook.saveToFile(TEST_FILE);
+}
+
+static void testExternalRewriteIsReindexed() {
+    writeTwoSheets();
+    Workbook workbook;
+    workbook.loadFromFile(TEST_FILE);
+    changeExternally(1, 0, "123456789");
+    check(cellText(workbook.sheetAt(1), 0, 0) == "hello", "lazy load after an external rewrite reads the right sheet");
+    check(cellText(workbook.sheetAt(1), 1, 0) == "42", "lazy load after an external rewrite reads the whole sheet");
+
+    writeTwoSheets();
+    Workbook copy;
+    copy.loadFromFile(TEST_FILE);
+    changeExternally(1, 0, "123456789");
+    check(copy.saveToFile(COPY_FILE), "unloaded sheets are copied from the rewritten file");
+    Workbook saved;
+    saved.loadFromFile(COPY_FILE);
+    check(cellText(saved.sheetAt(1), 0, 0) == "hello", "saved copy keeps the unloaded sheet");
+    check(cellText(saved.sheetAt(0), 1, 0) == "123456789", "saved copy has the rewritten sheet");
+}
+
+static void testCleanSheetOfRewrittenFileIsPaged() {
+    writeTwoSheets();
+    Workbook workbook;
+    workbook.loadFromFile(TEST_FILE);
+    workbook.sheetAt(0);
+    check(cellText(workbook.sheetAt(1), 0, 0) == "hello", "S2 loads");
+    changeExternally(0, 0, "7", 1);
+
+    workbook.sheetCacheLimit = 1;
+    workbook.trimCache();
+    check(!workbook.isLoaded(1) && workbook.isPaged(1), "clean sheet of a rewritten file is paged");
+    check(cellText(workbook.sheetAt(1), 0, 0) == "hello", "evicted sheet comes back unchanged");
+}
+
+int main() {
+    testMergeKeepsLocalEdits();
+    testMergeAppliesExternalClears();
+    testMergeBaseIsCompact();
+    testMergeBaseSurvivesEviction();
+    testEvictedSheetPropagatesChanges();
+    testPageFileStaysCompact();
+    testCleanSheetsAreNotPaged();
+    testExternalRewriteIsReindexed();
+    testCleanSheetOfRewrittenFileIsPaged();
+    std::remove(TEST_FILE);
+    std::remove(COPY_FILE);
+    return failures == 0 ? 0 : 1;
+}